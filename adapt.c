@@ -0,0 +1,164 @@
+#include "adapt.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// dla każdej pary systemów plików i klasy rozmiaru (potęgi dwójki) mierzona jest przepustowość
+// każdego sposobu kopiowania; wybierany jest najszybszy, a co EXPLORE_EVERY kopię sprawdzany inny
+
+#define SIZE_CLASSES 32
+#define MIN_SAMPLES 3
+#define EXPLORE_EVERY 16
+#define EWMA_WEIGHT 0.2
+#define SWITCH_MARGIN 1.1 // nowy sposób musi być szybszy o 10%, żeby wybór nie przeskakiwał przy szumie pomiarów
+
+typedef struct arm_stats
+{
+    unsigned samples;
+    double throughput; // bajty na nanosekundę, średnia wykładnicza
+} arm_stats;
+
+typedef struct size_class
+{
+    arm_stats arms[ARM_COUNT];
+    unsigned choices;
+    int best; // ostatnio zgłoszony najlepszy sposób, -1 jeśli jeszcze nieznany
+} size_class;
+
+typedef struct fs_pair
+{
+    dev_t src_dev, dst_dev;
+    size_class classes[SIZE_CLASSES];
+    int threshold_class; // najmniejsza klasa, w której mmap wygrywa, zgłoszona w dzienniku
+} fs_pair;
+
+static const char *arm_names[ARM_COUNT] = { "read/write 16 KiB", "read/write 64 KiB", "read/write 256 KiB", "read/write 1 MiB", "mmap" };
+static const size_t arm_chunks[ARM_COUNT] = { 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024, 0 };
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static fs_pair *pairs = NULL;
+static size_t pair_count = 0;
+
+static int class_of(off_t size)
+{
+    int c = 0;
+    while (c < SIZE_CLASSES - 1 && ((off_t)1 << (c + 1)) <= size) c++;
+    return c;
+}
+
+static fs_pair *find_pair(dev_t src_dev, dev_t dst_dev) // wywoływane pod blokadą
+{
+    size_t i;
+    for (i = 0; i < pair_count; i++)
+    {
+        if (pairs[i].src_dev == src_dev && pairs[i].dst_dev == dst_dev) return &pairs[i];
+    }
+    fs_pair *p = realloc(pairs, (pair_count + 1) * sizeof(*pairs));
+    if (p == NULL) return NULL;
+    pairs = p;
+    fs_pair *pair = &pairs[pair_count++];
+    pair->src_dev = src_dev;
+    pair->dst_dev = dst_dev;
+    pair->threshold_class = -1;
+    int c, a;
+    for (c = 0; c < SIZE_CLASSES; c++)
+    {
+        pair->classes[c].choices = 0;
+        pair->classes[c].best = -1;
+        for (a = 0; a < ARM_COUNT; a++)
+        {
+            pair->classes[c].arms[a].samples = 0;
+            pair->classes[c].arms[a].throughput = 0;
+        }
+    }
+    return pair;
+}
+
+static int best_arm(const size_class *sc) // -1, dopóki któryś sposób nie ma dość pomiarów
+{
+    int a, best = 0;
+    for (a = 0; a < ARM_COUNT; a++)
+    {
+        if (sc->arms[a].samples < MIN_SAMPLES) return -1;
+        if (sc->arms[a].throughput > sc->arms[best].throughput) best = a;
+    }
+    return best;
+}
+
+copy_arm adapt_choose(dev_t src_dev, dev_t dst_dev, off_t size)
+{
+    copy_arm arm = ARM_RW_64K;
+    pthread_mutex_lock(&lock);
+    fs_pair *pair = find_pair(src_dev, dst_dev);
+    if (pair != NULL)
+    {
+        size_class *sc = &pair->classes[class_of(size)];
+        unsigned n = sc->choices++;
+        int a;
+        for (a = 0; a < ARM_COUNT; a++) // najpierw każdy sposób musi zebrać kilka pomiarów
+        {
+            if (sc->arms[(n + a) % ARM_COUNT].samples < MIN_SAMPLES)
+            {
+                arm = (n + a) % ARM_COUNT;
+                break;
+            }
+        }
+        if (a == ARM_COUNT) arm = (n % EXPLORE_EVERY == 0 ? (int)((n / EXPLORE_EVERY) % ARM_COUNT) : (sc->best >= 0 ? sc->best : best_arm(sc)));
+    }
+    pthread_mutex_unlock(&lock);
+    return arm;
+}
+
+static void report(const fs_pair *pair, int c, const size_class *sc) // zgłoś zmianę wyboru w dzienniku
+{
+    char range[64];
+    if (c == 0) snprintf(range, sizeof(range), "below 2 B");
+    else snprintf(range, sizeof(range), "%llu-%llu B", 1ULL << c, (1ULL << (c + 1)) - 1);
+    log_printf(LOG_LEVEL_INFO, "Adaptive copy (device %llu to %llu), files of %s: %s, %.1f MB/s\n",
+               (unsigned long long)pair->src_dev, (unsigned long long)pair->dst_dev, range, arm_names[sc->best], sc->arms[sc->best].throughput * 1000);
+}
+
+void adapt_record(dev_t src_dev, dev_t dst_dev, off_t size, copy_arm arm, uint64_t ns)
+{
+    if (ns == 0) ns = 1;
+    double throughput = (double)(size > 0 ? size : 1) / ns;
+    pthread_mutex_lock(&lock);
+    fs_pair *pair = find_pair(src_dev, dst_dev);
+    if (pair == NULL)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    int c = class_of(size);
+    size_class *sc = &pair->classes[c];
+    arm_stats *as = &sc->arms[arm];
+    as->throughput = (as->samples == 0 ? throughput : (1 - EWMA_WEIGHT) * as->throughput + EWMA_WEIGHT * throughput);
+    as->samples++;
+
+    int best = best_arm(sc);
+    if (best >= 0 && best != sc->best && (sc->best < 0 || sc->arms[best].throughput > SWITCH_MARGIN * sc->arms[sc->best].throughput))
+    {
+        sc->best = best;
+        report(pair, c, sc);
+    }
+    int threshold = -1; // najmniejsza klasa, od której mmap jest najszybszy we wszystkich zmierzonych większych klasach
+    for (c = SIZE_CLASSES - 1; c >= 0; c--)
+    {
+        if (pair->classes[c].best < 0) continue;
+        if (pair->classes[c].best != ARM_MMAP) break;
+        threshold = c;
+    }
+    if (threshold != pair->threshold_class)
+    {
+        pair->threshold_class = threshold;
+        if (threshold >= 0) log_printf(LOG_LEVEL_INFO, "Adaptive copy (device %llu to %llu): mmap threshold %llu B\n",
+                                       (unsigned long long)src_dev, (unsigned long long)dst_dev, 1ULL << threshold);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+size_t adapt_chunk(copy_arm arm)
+{
+    return arm_chunks[arm];
+}
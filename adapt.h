@@ -0,0 +1,25 @@
+#ifndef FILESYNC_ADAPT
+#define FILESYNC_ADAPT
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum copy_arm // sprawdzane sposoby kopiowania
+{
+    ARM_RW_16K,
+    ARM_RW_64K,
+    ARM_RW_256K,
+    ARM_RW_1M,
+    ARM_MMAP,
+    ARM_COUNT
+} copy_arm;
+
+#define ADAPT_MAX_CHUNK (1024 * 1024)
+
+copy_arm adapt_choose(dev_t src_dev, dev_t dst_dev, off_t size);
+void adapt_record(dev_t src_dev, dev_t dst_dev, off_t size, copy_arm arm, uint64_t ns);
+size_t adapt_chunk(copy_arm arm);
+
+#endif
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include "filesync.h"
+#include "stats.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// generuje syntetyczne drzewo źródłowe i mierzy run_filesync w trzech scenariuszach:
+// cold (pusty katalog docelowy), warm (część plików zmieniona), nochange (ponowne skanowanie bez zmian)
+
+typedef struct bench_config
+{
+    const char *dir;
+    int depth, fanout, files;
+    off_t min_size, max_size;
+    unsigned seed;
+    int jobs;
+    double change_ratio;
+} bench_config;
+
+typedef struct strategy
+{
+    const char *name;
+    off_t size_threshold;
+    bool kernel_copy, io_uring, adaptive;
+} strategy;
+
+static const strategy strategies[] =
+{
+    { "read/write", (off_t)INT64_MAX, false, false, false },
+    { "mmap", 0, false, false, false },
+    { "kernel", 1000000, true, false, false },
+    { "io_uring", 1000000, false, true, false },
+    { "adaptive", 1000000, false, false, true },
+};
+
+static uint64_t rng_state;
+
+static uint64_t rnd(void) // xorshift64*, powtarzalny dla danego ziarna
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static off_t random_size(const bench_config *cfg) // rozkład logarytmicznie jednostajny między min_size i max_size
+{
+    double lo = log((double)cfg->min_size + 1), hi = log((double)cfg->max_size + 1);
+    double u = (rnd() >> 11) * (1.0 / 9007199254740992.0);
+    return (off_t)(exp(lo + (hi - lo) * u) - 1);
+}
+
+static int write_file(const char *path, off_t size, char *buf, size_t buf_size)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+    while (size > 0)
+    {
+        size_t n = (size < (off_t)buf_size ? (size_t)size : buf_size);
+        size_t i;
+        for (i = 0; i + 8 <= n; i += 8) // zawartość losowa, żeby żaden system plików jej nie skompresował
+        {
+            uint64_t v = rnd();
+            memcpy(buf + i, &v, 8);
+        }
+        if (write(fd, buf, n) != (ssize_t)n)
+        {
+            close(fd);
+            return -1;
+        }
+        size -= n;
+    }
+    return close(fd);
+}
+
+static int generate(const char *path, int level, const bench_config *cfg, uint64_t *files, uint64_t *bytes, char *buf, size_t buf_size)
+{
+    if (mkdir(path, 0755) != 0) return -1;
+    char child[PATH_MAX];
+    int i;
+    for (i = 0; i < cfg->files; i++)
+    {
+        off_t size = random_size(cfg);
+        snprintf(child, sizeof(child), "%s/file%d", path, i);
+        if (write_file(child, size, buf, buf_size) != 0) return -1;
+        (*files)++;
+        *bytes += size;
+    }
+    if (level >= cfg->depth) return 0;
+    for (i = 0; i < cfg->fanout; i++)
+    {
+        snprintf(child, sizeof(child), "%s/dir%d", path, i);
+        if (generate(child, level + 1, cfg, files, bytes, buf, buf_size) != 0) return -1;
+    }
+    return 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void remove_tree(const char *path)
+{
+    nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+static double change_ratio;
+
+static int touch_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) // przesuń czas modyfikacji części plików
+{
+    (void)ftw;
+    if (flag != FTW_F || (rnd() >> 11) * (1.0 / 9007199254740992.0) >= change_ratio) return 0;
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { st->st_mtime + 1, 0 } };
+    utimensat(AT_FDCWD, path, times, 0);
+    return 0;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_scenario(const char *scenario, const strategy *st, const sync_options *opts, const char *src, const char *dst)
+{
+    double start = now();
+    run_filesync(src, dst, opts);
+    double seconds = now() - start;
+
+    uint64_t counters[STAT_COUNTERS], files, bytes;
+    stats_cycle_totals(counters, &files, &bytes);
+    uint64_t entries = counters[STAT_ENTRIES];
+    // jeden wiersz JSON na pomiar, do porównywania wyników między kompilacjami
+    printf("{\"scenario\": \"%s\", \"strategy\": \"%s\", \"jobs\": %d, \"seconds\": %.6f, \"entries\": %llu, \"files_copied\": %llu, \"bytes_copied\": %llu, "
+           "\"entries_per_s\": %.1f, \"files_per_s\": %.1f, \"mb_per_s\": %.2f, \"stat_calls_per_entry\": %.3f, \"errors\": %llu}\n",
+           scenario, st->name, opts->jobs, seconds, (unsigned long long)entries, (unsigned long long)files, (unsigned long long)bytes,
+           entries / seconds, files / seconds, bytes / seconds / 1e6, entries > 0 ? (double)counters[STAT_STATS] / entries : 0.0,
+           (unsigned long long)counters[STAT_ERRORS]);
+    fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s scratch_dir [-d depth] [-f fanout] [-n files_per_dir] [-a min_size] [-b max_size] [-r change_ratio] [-j jobs] [-x seed]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_config cfg = { NULL, 3, 4, 50, 1024, 1024 * 1024, 1, 1, 0.1 };
+    int opt;
+    while ((opt = getopt(argc, argv, "d:f:n:a:b:r:j:x:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd': cfg.depth = atoi(optarg); break;
+            case 'f': cfg.fanout = atoi(optarg); break;
+            case 'n': cfg.files = atoi(optarg); break;
+            case 'a': cfg.min_size = atoll(optarg); break;
+            case 'b': cfg.max_size = atoll(optarg); break;
+            case 'r': cfg.change_ratio = atof(optarg); break;
+            case 'j': cfg.jobs = atoi(optarg); break;
+            case 'x': cfg.seed = strtoul(optarg, NULL, 10); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1 || cfg.depth < 0 || cfg.fanout < 0 || cfg.files < 0 || cfg.jobs <= 0 || cfg.min_size < 0 || cfg.max_size < cfg.min_size)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    cfg.dir = argv[optind];
+    log_threshold = LOG_LEVEL_ERROR;
+
+    char src[PATH_MAX], dst[PATH_MAX];
+    snprintf(src, sizeof(src), "%s/bench-src", cfg.dir);
+    snprintf(dst, sizeof(dst), "%s/bench-dst", cfg.dir);
+    remove_tree(src);
+    remove_tree(dst);
+
+    rng_state = cfg.seed * 0x9E3779B97F4A7C15ULL + 1;
+    size_t buf_size = 1024 * 1024;
+    char *buf = malloc(buf_size);
+    uint64_t files = 0, bytes = 0;
+    double start = now();
+    if (buf == NULL || generate(src, 0, &cfg, &files, &bytes, buf, buf_size) != 0)
+    {
+        perror("Couldn't generate the source tree");
+        return 1;
+    }
+    free(buf);
+    fprintf(stderr, "Generated %llu files, %llu bytes in %.2f s\n", (unsigned long long)files, (unsigned long long)bytes, now() - start);
+    change_ratio = cfg.change_ratio;
+
+    size_t i;
+    for (i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++)
+    {
+        const strategy *st = &strategies[i];
+        sync_options opts = { .recursive = true, .size_threshold = st->size_threshold, .kernel_copy = st->kernel_copy, .jobs = cfg.jobs, .io_uring = st->io_uring, .adaptive = st->adaptive };
+        remove_tree(dst);
+        mkdir(dst, 0755);
+        run_scenario("cold", st, &opts, src, dst);
+        rng_state = cfg.seed * 0x9E3779B97F4A7C15ULL + 2; // każda strategia zmienia te same pliki
+        nftw(src, touch_entry, 64, FTW_PHYS);
+        run_scenario("warm", st, &opts, src, dst);
+        run_scenario("nochange", st, &opts, src, dst);
+    }
+    remove_tree(src);
+    remove_tree(dst);
+    return 0;
+}
@@ -0,0 +1,11 @@
+#!/bin/bash
+
+# Usage: ./bench.sh [scratch_dir] [bench options]
+# Results are printed as JSON lines, one per scenario and copy strategy.
+
+dir=${1:-/dev/shm}
+[ -d "$dir" ] || dir=/tmp
+shift
+
+gcc -O2 bench.c filesync.c index.c pool.c uring.c hash.c log.c stats.c adapt.c throttle.c trash.c filter.c rescan.c -o filesync-bench -pthread -lm || exit 1
+./filesync-bench "$dir" "$@"
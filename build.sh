@@ -1,3 +1,3 @@
 #!/bin/bash
 
-gcc daemonize.c filesync.c -o filesyncd
+gcc daemonize.c filesync.c watch.c index.c pool.c uring.c hash.c log.c stats.c adapt.c schedule.c throttle.c trash.c filter.c rescan.c control.c -o filesyncd -pthread
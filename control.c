@@ -0,0 +1,229 @@
+#include "control.h"
+#include "log.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+// żądania synchronizacji (gniazdo sterujące, SIGUSR1) są łączone do chwili ich pobrania przez pętlę
+// synchronizacji, więc seria żądań kończy się jednym przebiegiem; eventfd budzi czekającą pętlę
+
+#define MAX_PATHS 64 // przy większej liczbie poddrzew synchronizowane jest całe drzewo
+#define CONTROL_LINE (PATH_MAX + 16)
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t wake_once = PTHREAD_ONCE_INIT;
+static int wake_fd = -1;
+static sync_request pending;
+static void (*notify_fn)(void) = NULL;
+static int listen_fd = -1;
+
+static void create_wake_fd(void)
+{
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd == -1) log_printf(LOG_LEVEL_WARNING, "Couldn't create the request event, requests wait for the next cycle\n");
+}
+
+int control_fd(void)
+{
+    pthread_once(&wake_once, create_wake_fd);
+    return wake_fd;
+}
+
+void control_set_notify(void (*notify)(void)) // dodatkowe powiadomienie, np. dla harmonogramu par
+{
+    pthread_mutex_lock(&lock);
+    notify_fn = notify;
+    pthread_mutex_unlock(&lock);
+}
+
+static void clear_paths(sync_request *req)
+{
+    size_t i;
+    for (i = 0; i < req->count; i++) free(req->paths[i]);
+    free(req->paths);
+    req->paths = NULL;
+    req->count = 0;
+}
+
+void control_trigger(const char *path) // zgłoś żądanie synchronizacji poddrzewa, NULL oznacza całe drzewo
+{
+    int fd = control_fd();
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; path != NULL && !pending.full && i < pending.count; i++)
+    {
+        if (strcmp(pending.paths[i], path) == 0) break; // to samo poddrzewo już czeka
+    }
+    if (path == NULL || pending.count == MAX_PATHS) pending.full = true;
+    if (pending.full) clear_paths(&pending);
+    else if (i == pending.count)
+    {
+        char **paths = realloc(pending.paths, (pending.count + 1) * sizeof(*paths));
+        if (paths != NULL) pending.paths = paths;
+        if (paths == NULL || (pending.paths[pending.count] = strdup(path)) == NULL)
+        {
+            clear_paths(&pending);
+            pending.full = true;
+        }
+        else pending.count++;
+    }
+    void (*notify)(void) = notify_fn;
+    pthread_mutex_unlock(&lock);
+    uint64_t one = 1;
+    if (fd != -1 && write(fd, &one, sizeof(one)) < 0) log_printf(LOG_LEVEL_WARNING, "Couldn't signal the request event\n");
+    if (notify != NULL) notify();
+}
+
+bool control_take(sync_request *req) // pobierz oczekujące żądania bez czekania
+{
+    uint64_t value;
+    int fd = control_fd();
+    if (fd != -1) while (read(fd, &value, sizeof(value)) > 0);
+    pthread_mutex_lock(&lock);
+    bool res = pending.full || pending.count > 0;
+    *req = pending;
+    memset(&pending, 0, sizeof(pending));
+    pthread_mutex_unlock(&lock);
+    return res;
+}
+
+bool control_wait(time_t deadline, sync_request *req) // czekaj na żądanie najdłużej do podanej chwili
+{
+    int fd = control_fd();
+    time_t now;
+    while ((now = time(NULL)) < deadline)
+    {
+        if (control_take(req)) return true;
+        if (fd == -1)
+        {
+            sleep(deadline - now);
+            continue;
+        }
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        poll(&pfd, 1, (int)(deadline - now) * 1000);
+    }
+    return control_take(req);
+}
+
+void control_release(sync_request *req)
+{
+    clear_paths(req);
+    req->full = false;
+}
+
+static void reply(int fd, const char *text)
+{
+    size_t len = strlen(text);
+    while (len > 0)
+    {
+        ssize_t n = send(fd, text, len, MSG_NOSIGNAL); // klient mógł się już rozłączyć
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        text += n;
+        len -= n;
+    }
+}
+
+static void handle_command(int fd, char *line) // sync [ścieżka] | status | stats
+{
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strcmp(line, "sync") == 0)
+    {
+        log_printf(LOG_LEVEL_INFO, "Synchronization requested\n");
+        control_trigger(NULL);
+        reply(fd, "OK synchronization of the whole tree queued\n");
+    }
+    else if (strncmp(line, "sync ", 5) == 0 && line[5] != '\0')
+    {
+        log_printf(LOG_LEVEL_INFO, "Synchronization of %s requested\n", line + 5);
+        control_trigger(line + 5);
+        reply(fd, "OK synchronization queued\n");
+    }
+    else if (strcmp(line, "status") == 0)
+    {
+        char status[PATH_MAX + 256] = "OK ";
+        stats_status(status + 3, sizeof(status) - 3);
+        reply(fd, status);
+    }
+    else if (strcmp(line, "stats") == 0)
+    {
+        stats_dump();
+        reply(fd, "OK statistics written to the log\n");
+    }
+    else reply(fd, "ERROR unknown command, expected: sync [path], status, stats\n");
+}
+
+static void *control_thread(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            log_printf(LOG_LEVEL_ERROR, "Control socket failed, no longer accepting commands\n");
+            break;
+        }
+        struct timeval timeout = { 1, 0 }; // klient nie może zablokować obsługi pozostałych
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char line[CONTROL_LINE];
+        size_t len = 0;
+        ssize_t n;
+        while (len < sizeof(line) - 1 && (n = read(fd, line + len, sizeof(line) - 1 - len)) > 0)
+        {
+            len += n;
+            if (memchr(line, '\n', len) != NULL) break;
+        }
+        line[len] = '\0';
+        if (len > 0) handle_command(fd, line);
+        close(fd);
+    }
+    return NULL;
+}
+
+int control_start(const char *path) // gniazdo domeny uniksowej przyjmujące polecenia
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) return -1;
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path); // pozostałość po poprzednim uruchomieniu, innych plików nie usuwaj
+    mode_t mask = umask(0177); // gniazdo od chwili utworzenia dostępne tylko dla właściciela
+    int res = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (res != 0 || listen(listen_fd, 16) != 0)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+        return -1;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, control_thread, NULL) != 0)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(path);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef FILESYNC_CONTROL
+#define FILESYNC_CONTROL
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+typedef struct sync_request // żądania synchronizacji zebrane od ostatniego pobrania
+{
+    bool full;    // całe drzewo
+    char **paths; // poddrzewa, puste jeśli full
+    size_t count;
+} sync_request;
+
+int control_start(const char *path);
+void control_trigger(const char *path);
+void control_set_notify(void (*notify)(void));
+int control_fd(void);
+bool control_take(sync_request *req);
+bool control_wait(time_t deadline, sync_request *req);
+void control_release(sync_request *req);
+
+#endif
@@ -13,36 +13,51 @@
 #include <time.h>
 #include <limits.h>
 #include "filesync.h"
+#include "watch.h"
+#include "index.h"
+#include "log.h"
+#include "stats.h"
+#include "schedule.h"
+#include "throttle.h"
+#include "control.h"
+#include "trash.h"
+#include "filter.h"
+#include "rescan.h"
+#include <pthread.h>
 
 #define EXIT_SUCCESS 0
 #define EXIT_FAILURE 1
 
-bool uselog = false;
+static sigset_t handled_signals;
 
-void openLogFile()
+static void *signal_thread(void *arg) // sygnały odbierane synchronicznie, więc można w nich logować i zapisywać pliki
 {
-    openlog("filesyncd", LOG_PID, LOG_DAEMON);
-    uselog = true;
+    (void)arg;
+    int sig;
+    while (sigwait(&handled_signals, &sig) == 0)
+    {
+        if (sig == SIGUSR1) // synchronizacja na żądanie
+        {
+            writeToLog("Synchronization requested (SIGUSR1)\n");
+            control_trigger(NULL);
+        }
+        else if (sig == SIGUSR2) stats_dump();
+    }
+    return NULL;
 }
 
-void closeLogFile()
+static void start_signal_thread()
 {
-    closelog();
-    uselog = false;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, signal_thread, NULL) == 0) pthread_detach(thread);
+    else writeToLog("Couldn't start the signal thread\n");
 }
 
-void writeToLog(const char *str)
+static void start_control(const char *path)
 {
-    if (uselog) syslog(LOG_NOTICE, str);
-    else printf(str);
-}
-
-void handle_SIGUSR1(int signum)
-{
-    if (signum == SIGUSR1)
-    {
-        writeToLog("SIGUSR1\n");
-    }
+    if (path == NULL) return;
+    if (control_start(path) == 0) log_printf(LOG_LEVEL_INFO, "Accepting commands on %s\n", path);
+    else log_printf(LOG_LEVEL_ERROR, "Couldn't create the control socket (%s)\n", path);
 }
 
 static void make_daemon()
@@ -68,13 +83,13 @@ static void make_daemon()
         exit(EXIT_FAILURE);
 
     /* Catch, ignore and handle signals */
-    //TODO: Implement a working signal handler */
     signal(SIGCHLD, SIG_IGN);
     signal(SIGHUP, SIG_IGN);
-    //signal(SIGUSR1, handle_SIGUSR1);
-    struct sigaction sa;
-    sa.sa_handler = handle_SIGUSR1;
-    sigaction(SIGUSR1, &sa, NULL);
+    // SIGUSR1 i SIGUSR2 zablokowane we wszystkich wątkach, odbiera je tylko wątek sygnałów
+    sigemptyset(&handled_signals);
+    sigaddset(&handled_signals, SIGUSR1);
+    sigaddset(&handled_signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &handled_signals, NULL);
 
     /* Fork off for the second time*/
     pid = fork();
@@ -111,95 +126,419 @@ static void make_daemon()
 }
 
 #define print_usage() ( printf("Usage: %s source_path destination_path [-OPTIONS]\n"\
+                                "       %s -c config_file [-OPTIONS]\n"\
                                 "OPTIONS:\n"\
                                 "-R\t\t\tRecursive synchronization (include subdirectories)\n"\
                                 "-t sleep_time\t\tSets number of seconds between synchronizations\n"\
                                 "-s size_threshold\tSets file size threshold at which mmap will be used\n"\
-                                "-S\t\t\tSingle synchronization\n", argv[0]) )
+                                "-S\t\t\tSingle synchronization\n"\
+                                "-w\t\t\tWatch the source for changes and sync only changed directories\n"\
+                                "-x max_staleness\tRescan unchanged directories less often, but at least every max_staleness seconds\n"\
+                                "\t\t\t(for NFS or FUSE sources without change notification)\n"\
+                                "-i\t\t\tKeep an index of synchronized files to skip unchanged directories\n"\
+                                "-k\t\t\tCopy in the kernel (reflink, copy_file_range, sendfile) when possible\n"\
+                                "-j jobs\t\t\tNumber of threads scanning directories and copying files\n"\
+                                "-u\t\t\tCopy files in batches through io_uring when available\n"\
+                                "-d delta_threshold\tRewrite only changed blocks of existing files of at least this size\n"\
+                                "-r resume_threshold\tCheckpoint copies of files of at least this size and resume them after an interruption\n"\
+                                "-e rules_file\t\tSkip entries matching exclude rules, one \"[+|-]pattern[/] [size>N] [age>N]\" per line\n"\
+                                "-V\t\t\tVerify file content with a hash when modification times differ\n"\
+                                "-v\t\t\tLog every scanned and copied file\n"\
+                                "-m stats_file\t\tWrite synchronization statistics to a file (also dumped on SIGUSR2)\n"\
+                                "-a\t\t\tChoose mmap or read/write and the buffer size from measured throughput\n"\
+                                "-F\t\t\tFlush copied files to disk before replacing the destination\n"\
+                                "-H\t\t\tRecreate hard links between source files instead of copying each name\n"\
+                                "-P snapshots\t\tCreate a timestamped snapshot in the destination every cycle, hard-linking\n"\
+                                "\t\t\tunchanged files from the previous one, and keep this many snapshots\n"\
+                                "-p\t\t\tPlan every change first, then copy files in the order of their data on the disk\n"\
+                                "-D\t\t\tDry run: synchronize once and only report the planned changes\n"\
+                                "-b bytes_per_sec\tLimit the copy rate in bytes per second\n"\
+                                "-n files_per_sec\tLimit the number of copied files per second\n"\
+                                "-I class\t\tRun synchronization I/O in the idle or best-effort (be or be:0-7) priority class\n"\
+                                "-T HH:MM-HH:MM[,...]\tRun at full speed, without -b, -n and -I, inside these hours\n"\
+                                "-C socket_path\t\tAccept \"sync [path]\", \"status\" and \"stats\" commands on a Unix socket\n"\
+                                "\t\t\t(SIGUSR1 also requests an immediate synchronization)\n"\
+                                "-c config_file\t\tSynchronize the pairs listed in a file, one \"source destination [-OPTIONS]\" per line;\n"\
+                                "\t\t\tpairs share the -j threads and pairs on the same device never run at once\n", argv[0], argv[0]) )
 
-int main(int argc, char *argv[])
-{   
-    if (argc < 3)
+static const char *request_rel(const char *src, const char *path) // ścieżka z żądania względem katalogu źródłowego, NULL jeśli spoza niego
+{
+    if (path[0] == '/')
     {
-        print_usage();
-        return 0;
+        if (strcmp(path, src) == 0) return "";
+        if (!path_contains(src, path)) return NULL;
+        path += strlen(src) + 1;
+    }
+    while (strncmp(path, "./", 2) == 0) path += 2;
+    if (strcmp(path, "..") == 0 || strncmp(path, "../", 3) == 0 || strstr(path, "/../") != NULL) return NULL;
+    return path;
+}
+
+static bool rel_covers(const char *parent, const char *rel) // rel leży w poddrzewie parent lub jest nim
+{
+    size_t len = strlen(parent);
+    return len == 0 || (strncmp(parent, rel, len) == 0 && (rel[len] == '\0' || rel[len] == '/'));
+}
+
+static bool run_requests(const char *src, const char *dst, const sync_options *opts, sync_request *req) // wykonaj żądania z gniazda sterującego, true jeśli całe drzewo
+{
+    size_t i;
+    bool full = req->full || !opts->recursive || opts->snapshots > 0; // poddrzewa tylko w zwykłym trybie rekurencyjnym
+    if (full)
+    {
+        rescan_force(opts->rescan); // żądanie obejmuje także katalogi, których termin jeszcze nie minął
+        run_filesync(src, dst, opts);
+    }
+    char (*rels)[PATH_MAX] = (full ? NULL : malloc(req->count * sizeof(*rels)));
+    subtree *items = (full ? NULL : malloc(req->count * sizeof(*items)));
+    size_t count = 0, j;
+    for (i = 0; rels != NULL && items != NULL && i < req->count; i++)
+    {
+        const char *r = request_rel(src, req->paths[i]);
+        if (r == NULL)
+        {
+            log_printf(LOG_LEVEL_WARNING, "Requested path is outside the source directory (%s)\n", req->paths[i]);
+            continue;
+        }
+        snprintf(rels[count], PATH_MAX, "%s", r);
+        size_t len = strlen(rels[count]);
+        while (len > 0 && rels[count][len - 1] == '/') rels[count][--len] = '\0';
+        items[count].rel = rels[count];
+        items[count].recursive = true;
+        count++;
+    }
+    for (i = 0; i < count; i++) // poddrzewa serii są przetwarzane równolegle, więc zawarte w innych są pomijane
+    {
+        for (j = 0; j < count && items[i].rel != NULL; j++)
+        {
+            if (j != i && items[j].rel != NULL && rel_covers(items[j].rel, items[i].rel)) items[i].rel = NULL;
+        }
+    }
+    for (i = j = 0; i < count; i++)
+    {
+        if (items[i].rel != NULL) items[j++] = items[i];
+    }
+    if (!full && req->count > 0 && (rels == NULL || items == NULL)) log_printf(LOG_LEVEL_ERROR, "Couldn't allocate the requested paths\n");
+    sync_subtrees(src, dst, items, j, opts);
+    free(items);
+    free(rels);
+    control_release(req);
+    return full;
+}
+
+static void wait_next(const char *src, const char *dst, const sync_options *opts, int sleep_time) // czekaj na następną synchronizację, wykonując żądania
+{
+    time_t deadline = time(NULL) + sleep_time;
+    sync_request req;
+    while (control_wait(deadline, &req))
+    {
+        if (run_requests(src, dst, opts, &req)) deadline = time(NULL) + sleep_time; // pełna synchronizacja przesuwa następną okresową
     }
-    char *src, *dst;
-    bool recursive = false, single = false;
-    off_t size_threshold = 1000000;
-    int sleep_time = 300;
-    int i, op = 0;
+}
+
+#define WATCH_RETRY_TIME 5 // s, odstęp sprawdzania, czy usunięty katalog źródłowy został utworzony ponownie
+#define WATCH_COALESCE_TIME 3 // s, najdłuższe zbieranie zdarzeń jednej serii przed synchronizacją
+
+static void run_watch_loop(const char *src, const char *dst, const sync_options *opts, int sleep_time)
+{
+    watcher w;
+    if (watcher_init(&w, src, opts->recursive) != 0) // inotify niedostępne, wróć do okresowej synchronizacji
+    {
+        writeToLog("Couldn't watch the source directory, falling back to periodic synchronization\n");
+        while (1)
+        {
+            run_filesync(src, dst, opts);
+            wait_next(src, dst, opts, sleep_time);
+        }
+    }
+    w.wake_fd = control_fd();
+    char str[64];
+    snprintf(str, sizeof(str), "Watching %zu directories\n", w.watch_count);
+    writeToLog(str);
+
+    while (1)
+    {
+        if (w.rebuild) // po utracie zdarzeń, braku wolnych obserwacji lub zniknięciu katalogu głównego
+        {
+            if (watcher_rebuild(&w) == 0)
+            {
+                snprintf(str, sizeof(str), "Watching %zu directories\n", w.watch_count);
+                writeToLog(str);
+            }
+            else writeToLog("Couldn't watch the source directory, retrying after the next synchronization\n");
+        }
+        run_filesync(src, dst, opts); // pełne skanowanie jako zabezpieczenie
+        watcher_clear(&w);
+
+        time_t deadline = time(NULL) + sleep_time;
+        time_t now;
+        while ((now = time(NULL)) < deadline)
+        {
+            sync_request req;
+            if (control_take(&req)) // żądanie z gniazda sterującego lub SIGUSR1
+            {
+                if (run_requests(src, dst, opts, &req)) // pełna synchronizacja już wykonana, przesuwa następną okresową
+                {
+                    watcher_clear(&w);
+                    deadline = time(NULL) + sleep_time;
+                }
+                continue;
+            }
+            if (w.fd < 0) // katalog główny nie istnieje, sprawdzaj co chwilę, czy się pojawił
+            {
+                if (access(src, F_OK) == 0) break;
+                if (deadline - now > WATCH_RETRY_TIME) now = deadline - WATCH_RETRY_TIME;
+            }
+            if (watcher_wait(&w, (int)(deadline - now) * 1000) != 1) continue;
+            time_t first = time(NULL);
+            // zbierz kolejne zdarzenia z tej samej serii, ale nie dłużej niż WATCH_COALESCE_TIME, by ciągle zmieniane źródło też było synchronizowane
+            while ((now = time(NULL)) - first < WATCH_COALESCE_TIME && now < deadline && watcher_wait(&w, 500) == 1);
+            if (w.overflow)
+            {
+                writeToLog("Change events lost, running full rescan\n");
+                break;
+            }
+            subtree *items = malloc(w.dirty_count * sizeof(*items) + 1);
+            if (items == NULL)
+            {
+                writeToLog("Couldn't queue changed directories, running full rescan\n");
+                break;
+            }
+            size_t i;
+            for (i = 0; i < w.dirty_count; i++)
+            {
+                items[i].rel = w.dirty[i].rel;
+                items[i].recursive = w.dirty[i].recursive;
+            }
+            sync_subtrees(src, dst, items, w.dirty_count, opts); // jeden cykl dla całej serii zdarzeń
+            free(items);
+            watcher_clear(&w);
+        }
+    }
+}
+
+typedef struct cmd_options // opcje z wiersza poleceń lub z wiersza pliku konfiguracyjnego
+{
+    const char *src, *dst, *config, *control;
+    int paths;
+    bool single, watch, use_index;
+    int sleep_time;
+    int max_staleness; // -x, 0 przegląda wszystkie katalogi w każdym cyklu
+    sync_options opts;
+} cmd_options;
+
+static bool parse_options(int argc, char *argv[], cmd_options *o, bool in_config)
+{
+    int i;
     for (i = 1; i < argc; i++) // dla każdego argumentu programu
     {
         if (argv[i][0] != '-') // sprawdź czy argument zaczyna się od '-'
         {
-            op++;
-            if (op == 1) src = argv[i];
-            else if (op == 2) dst = argv[i];
+            o->paths++;
+            if (o->paths == 1) o->src = argv[i];
+            else if (o->paths == 2) o->dst = argv[i];
             continue;
         }
-        if (strlen(argv[i]) != 2)
+        if (strlen(argv[i]) != 2 || (in_config && strchr("SwmvcbnITCD", argv[i][1]) != NULL)) // opcje całego demona niedozwolone w pliku konfiguracyjnym
         {
-            print_usage();
-            return 0;
+            if (in_config) printf("Invalid option %s!\n", argv[i]);
+            else print_usage();
+            return false;
         }
         switch (argv[i][1]) // sprawdź argument opcjonalny
         {
             case 'R': // wywołanie rekurencyjne
-                recursive = true;
+                o->opts.recursive = true;
                 break;
             case 't': // czas między wywołaniami
                 i++;
-                int s = atoi(argv[i]);
-                if (s > 0) sleep_time = s;
+                int s = (i < argc ? atoi(argv[i]) : 0);
+                if (s > 0) o->sleep_time = s;
                 else
                 {
                     printf("Invalid sleep time!\n");
-                    return 0;
+                    return false;
+                }
+                break;
+            case 'x': // adaptacyjne przeglądanie katalogów
+                i++;
+                if (i >= argc || (o->max_staleness = atoi(argv[i])) <= 0)
+                {
+                    printf("Invalid maximum staleness!\n");
+                    return false;
                 }
                 break;
             case 's': // próg rozmiaru
                 i++;
-                if (sscanf(argv[i], "%zu", &size_threshold) != 1)
+                if (i >= argc || sscanf(argv[i], "%zu", &o->opts.size_threshold) != 1)
                 {
                     printf("Invalid size threshold!\n");
-                    return 0;
+                    return false;
                 }
                 break;
             case 'S': // pojedyncza synchronizacja
-                single = true;
+                o->single = true;
+                break;
+            case 'w': // obserwowanie zmian w katalogu źródłowym
+                o->watch = true;
+                break;
+            case 'i': // indeks zsynchronizowanych plików
+                o->use_index = true;
+                break;
+            case 'k': // kopiowanie po stronie jądra
+                o->opts.kernel_copy = true;
+                break;
+            case 'u': // kopiowanie przez io_uring
+                o->opts.io_uring = true;
+                break;
+            case 'd': // próg rozmiaru dla kopiowania różnicowego
+                i++;
+                if (i >= argc || sscanf(argv[i], "%zu", &o->opts.delta_threshold) != 1)
+                {
+                    printf("Invalid delta threshold!\n");
+                    return false;
+                }
+                break;
+            case 'r': // próg rozmiaru dla kopii wznawianych
+                i++;
+                if (i >= argc || sscanf(argv[i], "%zu", &o->opts.resume_threshold) != 1)
+                {
+                    printf("Invalid resume threshold!\n");
+                    return false;
+                }
+                break;
+            case 'e': // plik reguł włączania i wykluczania
+                i++;
+                if (i >= argc || (o->opts.filter = filter_load(argv[i])) == NULL)
+                {
+                    printf("Invalid rules file!\n");
+                    return false;
+                }
+                break;
+            case 'm': // plik statystyk
+                i++;
+                if (i >= argc)
+                {
+                    printf("Invalid statistics file!\n");
+                    return false;
+                }
+                stats_set_file(argv[i]);
+                break;
+            case 'v': // komunikaty dla każdego pliku
+                log_threshold = LOG_LEVEL_DEBUG;
+                break;
+            case 'F': // utrwalanie kopii na dysku
+                o->opts.fsync = true;
+                break;
+            case 'a': // adaptacyjny wybór sposobu kopiowania
+                o->opts.adaptive = true;
+                break;
+            case 'V': // porównywanie zawartości plików
+                o->opts.verify = true;
+                break;
+            case 'P': // kopie migawkowe
+                i++;
+                if (i >= argc || (o->opts.snapshots = atoi(argv[i])) <= 0)
+                {
+                    printf("Invalid number of snapshots!\n");
+                    return false;
+                }
+                break;
+            case 'H': // odtwarzanie twardych dowiązań
+                o->opts.hard_links = true;
+                break;
+            case 'p': // planowanie przed wykonaniem
+                o->opts.plan = true;
+                break;
+            case 'D': // tylko raport planowanych zmian
+                o->opts.dry_run = true;
+                o->single = true;
+                break;
+            case 'j': // liczba wątków
+                i++;
+                if (i >= argc || (o->opts.jobs = atoi(argv[i])) <= 0)
+                {
+                    printf("Invalid number of jobs!\n");
+                    return false;
+                }
+                break;
+            case 'b': // limit bajtów na sekundę
+            case 'n': // limit plików na sekundę
+            {
+                unsigned long long rate;
+                i++;
+                if (i >= argc || sscanf(argv[i], "%llu", &rate) != 1 || rate == 0)
+                {
+                    printf("Invalid rate limit!\n");
+                    return false;
+                }
+                if (argv[i - 1][1] == 'b') throttle_set_byte_rate(rate);
+                else throttle_set_file_rate(rate);
+                break;
+            }
+            case 'I': // klasa priorytetu wejścia-wyjścia
+                i++;
+                if (i >= argc || throttle_set_ioprio(argv[i]) != 0)
+                {
+                    printf("Invalid I/O priority class!\n");
+                    return false;
+                }
+                break;
+            case 'T': // godziny pracy bez ograniczeń
+                i++;
+                if (i >= argc || throttle_set_schedule(argv[i]) != 0)
+                {
+                    printf("Invalid schedule!\n");
+                    return false;
+                }
+                break;
+            case 'C': // gniazdo sterujące
+                i++;
+                if (i >= argc)
+                {
+                    printf("Invalid control socket path!\n");
+                    return false;
+                }
+                o->control = argv[i];
+                break;
+            case 'c': // plik konfiguracyjny z wieloma parami katalogów
+                i++;
+                if (i >= argc)
+                {
+                    printf("Invalid configuration file!\n");
+                    return false;
+                }
+                o->config = argv[i];
                 break;
             default:
-                print_usage();
-                return 0;
+                if (in_config) printf("Invalid option %s!\n", argv[i]);
+                else print_usage();
+                return false;
         }
     }
-    if (op != 2)
-    {
-        print_usage();
-        return 0;
-    }
-    
+    return true;
+}
+
+static bool check_paths(const char *src, const char *dst, bool recursive, char *real_src, char *real_dst)
+{
     // pełne ścieżki katalogów
-    char real_src[PATH_MAX];
-    char real_dst[PATH_MAX];
-    realpath(src, real_src);
-    realpath(dst, real_dst);
+    if (realpath(src, real_src) == NULL) real_src[0] = '\0';
+    if (realpath(dst, real_dst) == NULL) real_dst[0] = '\0';
 
     if (get_file_type(real_src) != FT_DIRECTORY) // sprawdź czy istnieje katalog źródłowy
     {
         printf("Invalid source directory!\n");
-        return 0;
+        return false;
     }
     if (get_file_type(real_dst) != FT_DIRECTORY) // sprawdź czy istnieje katalog docelowy
     {
         printf("Invalid destination directory!\n");
-        return 0;
+        return false;
     }
     if (strcmp(real_src, real_dst) == 0) // sprawdź czy katalogi są różne
     {
         printf("The destination directory must be different from the source directory!\n");
-        return 0;
+        return false;
     }
     
     if (recursive) // jeśli wybrano tryb rekurencyjny, sprawdź czy katalogi nie zawierają się w sobie
@@ -207,33 +546,206 @@ int main(int argc, char *argv[])
         if (path_contains(real_src, real_dst))
         {
             printf("Source directory must not contain the destination directory!\n");
-            return 0;
+            return false;
         }
         else if (path_contains(real_dst, real_src))
         {
             printf("Destination directory must not contain the source directory!\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+#define CONFIG_MAX_ARGS 64
+
+static sync_pair *load_config(const char *path, const cmd_options *defaults, size_t *count) // wiersz: source_path destination_path [-OPTIONS]
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        printf("Couldn't open the configuration file!\n");
+        return NULL;
+    }
+    sync_pair *pairs = NULL;
+    size_t cap = 0;
+    char line[2 * PATH_MAX + 256];
+    int line_no = 0;
+    bool ok = true;
+    *count = 0;
+    while (ok && fgets(line, sizeof(line), f) != NULL)
+    {
+        line_no++;
+        char *args[CONFIG_MAX_ARGS], *save;
+        int argc = 1;
+        args[0] = (char *)path;
+        char *tok = strtok_r(line, " \t\r\n", &save);
+        while (tok != NULL && tok[0] != '#' && argc < CONFIG_MAX_ARGS)
+        {
+            args[argc++] = tok;
+            tok = strtok_r(NULL, " \t\r\n", &save);
+        }
+        if (argc == 1) continue; // pusty wiersz lub komentarz
+
+        cmd_options o = *defaults; // opcje z wiersza poleceń obowiązują wszystkie pary
+        o.paths = 0;
+        o.opts.jobs = 1;
+        if (!parse_options(argc, args, &o, true) || o.paths != 2)
+        {
+            printf("Invalid configuration line %d!\n", line_no);
+            ok = false;
+            break;
+        }
+        if (*count == cap)
+        {
+            cap = (cap ? cap * 2 : 8);
+            sync_pair *p = realloc(pairs, cap * sizeof(*p));
+            if (p == NULL)
+            {
+                ok = false;
+                break;
+            }
+            pairs = p;
+        }
+        sync_pair *p = &pairs[*count];
+        memset(p, 0, sizeof(*p));
+        if (!check_paths(o.src, o.dst, o.opts.recursive, p->src, p->dst) || (o.opts.dry_run && o.opts.snapshots > 0))
+        {
+            printf("Invalid configuration line %d!\n", line_no);
+            ok = false;
+            break;
+        }
+        p->opts = o.opts;
+        if (o.max_staleness > 0) p->opts.rescan = rescan_create(o.max_staleness);
+        p->interval = o.sleep_time;
+        p->use_index = o.use_index;
+        (*count)++;
+    }
+    fclose(f);
+    if (ok && *count == 0)
+    {
+        printf("No directory pairs in the configuration file!\n");
+        ok = false;
+    }
+    if (!ok)
+    {
+        free(pairs);
+        return NULL;
+    }
+    return pairs;
+}
+
+static int run_config(cmd_options *o) // wiele par katalogów we wspólnym harmonogramie
+{
+    if (o->watch)
+    {
+        printf("Watching is not supported with a configuration file!\n");
+        return 0;
+    }
+    size_t count, i;
+    sync_pair *pairs = load_config(o->config, o, &count);
+    if (pairs == NULL) return 0;
+
+    if (!o->single)
+    {
+        make_daemon();
+        log_start(); // wątek zapisujący nie przetrwałby fork()
+        start_signal_thread();
+        start_control(o->control);
+        writeToLog("File Sync Daemon started\n");
+    }
+    else log_start();
+
+    for (i = 0; i < count; i++)
+    {
+        if (pairs[i].use_index && !pairs[i].opts.dry_run) pairs[i].opts.index = index_open(pairs[i].dst, filter_hash(pairs[i].opts.filter));
+    }
+    run_schedule(pairs, count, o->opts.jobs, o->single); // bez -S nie kończy się
+    trash_wait();
+    for (i = 0; i < count; i++) index_close(pairs[i].opts.index);
+    free(pairs);
+    log_stop();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{   
+    if (argc < 3)
+    {
+        print_usage();
+        return 0;
+    }
+    cmd_options o = { .sleep_time = 300, .opts = { .size_threshold = 1000000, .jobs = 1 } }; // pozostałe opcje wyłączone
+    if (!parse_options(argc, argv, &o, false)) return 0;
+    if (o.config != NULL)
+    {
+        if (o.paths != 0)
+        {
+            print_usage();
             return 0;
         }
+        return run_config(&o);
+    }
+    if (o.paths != 2)
+    {
+        print_usage();
+        return 0;
     }
     
-    if (single) // pojedyncza synchronizacja
+    char real_src[PATH_MAX];
+    char real_dst[PATH_MAX];
+    if (!check_paths(o.src, o.dst, o.opts.recursive, real_src, real_dst)) return 0;
+    if (o.watch && o.opts.snapshots > 0)
     {
-        run_filesync(real_src, real_dst, recursive, size_threshold);
+        printf("Watching is not supported with snapshots!\n");
+        return 0;
+    }
+    if (o.max_staleness > 0 && o.opts.snapshots > 0)
+    {
+        printf("Adaptive rescanning is not supported with snapshots!\n");
+        return 0;
+    }
+    if (o.opts.dry_run && o.opts.snapshots > 0)
+    {
+        printf("Dry run is not supported with snapshots!\n");
+        return 0;
+    }
+    
+    sync_options opts = o.opts;
+    if (o.max_staleness > 0) opts.rescan = rescan_create(o.max_staleness);
+    bool use_index = o.use_index, watch = o.watch;
+    int sleep_time = o.sleep_time;
+
+    if (o.single) // pojedyncza synchronizacja
+    {
+        log_start();
+        if (use_index && !opts.dry_run) opts.index = index_open(real_dst, filter_hash(opts.filter)); // próba na sucho nie tworzy katalogu stanu
+        run_filesync(real_src, real_dst, &opts);
+        trash_wait(); // usunięte katalogi są kasowane w tle
+        index_close(opts.index);
+        log_stop();
         return 0;
     }
 
     make_daemon();
+    log_start(); // wątek zapisujący nie przetrwałby fork()
+    start_signal_thread();
+    start_control(o.control);
 
     writeToLog("File Sync Daemon started\n");
 
+    if (use_index) opts.index = index_open(real_dst, filter_hash(opts.filter));
+    if (watch) run_watch_loop(real_src, real_dst, &opts, sleep_time);
+
     while (1)
     {
-        run_filesync(real_src, real_dst, recursive, size_threshold);
-        sleep(sleep_time);
+        run_filesync(real_src, real_dst, &opts);
+        wait_next(real_src, real_dst, &opts, sleep_time);
     }
 
     writeToLog("File Sync Daemon terminated\n");
-    closelog();
+    log_stop();
+    closeLogFile();
 
     return EXIT_SUCCESS;
 }
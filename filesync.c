@@ -1,4 +1,16 @@
+#define _GNU_SOURCE
 #include "filesync.h"
+#include "index.h"
+#include "pool.h"
+#include "uring.h"
+#include "hash.h"
+#include "log.h"
+#include "stats.h"
+#include "adapt.h"
+#include "throttle.h"
+#include "trash.h"
+#include "filter.h"
+#include "rescan.h"
 #include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
@@ -12,8 +24,15 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/xattr.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-void writeToLog(const char *str);
 
 file_type get_file_type(const char *path) // sprawdź typ pliku
 {
@@ -54,6 +73,12 @@ int set_mtime(const char *path, time_t mtime) // ustaw czas modyfikacji pliku
     return utime(path, &utb);
 }
 
+int set_mtime_ns(const char *path, const struct timespec *mtime) // ustaw czas modyfikacji z dokładnością do nanosekund
+{
+    struct timespec times[2] = { { 0, UTIME_OMIT }, *mtime };
+    return utimensat(AT_FDCWD, path, times, 0);
+}
+
 off_t get_size(const char *path) // sprawdź rozmiar pliku
 {
     struct stat statbuf;
@@ -75,359 +100,2315 @@ bool path_contains(const char *path1, const char *path2) // sprawdź czy katalog
     return (strncmp(pth1, path2, strlen(pth1)) == 0);
 }
 
-int copy_rw(const char *src_ent_path, const char *dst_ent_path)
+#define COPY_BUFFER_ALIGN 4096
+#define COPY_CHUNK (16 * 1024)
+
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+static __thread char *copy_buffer = NULL;
+static __thread size_t copy_buffer_size = 0;
+
+static void create_buffer_key(void)
+{
+    pthread_key_create(&buffer_key, free);
+}
+
+static char *get_copy_buffer(size_t size) // wyrównany bufor wątku, używany ponownie dla kolejnych plików
+{
+    if (copy_buffer_size >= size) return copy_buffer;
+    void *buffer;
+    if (posix_memalign(&buffer, COPY_BUFFER_ALIGN, size) != 0) return NULL;
+    free(copy_buffer);
+    copy_buffer = buffer;
+    copy_buffer_size = size;
+    pthread_once(&buffer_key_once, create_buffer_key);
+    pthread_setspecific(buffer_key, copy_buffer); // zwolnij bufor po zakończeniu wątku
+    return copy_buffer;
+}
+
+#define TMP_PREFIX ".filesyncd.tmp." // pliki tymczasowe, gdy system plików nie obsługuje O_TMPFILE
+#define PART_PREFIX ".filesyncd.part." // przerwane kopie dużych plików (-r), wznawiane od punktu kontrolnego
+
+static __thread bool fsync_files = false; // -F, ustawiane w wątku przed kopiowaniem (pary z -c mają różne opcje)
+
+typedef struct replacement // nowa zawartość pliku docelowego, widoczna dopiero po podmianie
+{
+    int fd;
+    bool anonymous; // O_TMPFILE, plik nie ma jeszcze nazwy
+    char tmp[PATH_MAX];
+} replacement;
+
+static atomic_bool tmpfile_unusable = false; // nadawanie nazwy plikom O_TMPFILE przez /proc zawiodło
+
+static void hidden_name(const char *dst, const char *prefix, char *tmp, size_t size) // ukryta nazwa obok pliku docelowego
+{
+    // skrót nazwy zamiast samej nazwy, żeby przedrostek nie przekroczył NAME_MAX przy długich nazwach
+    const char *slash = strrchr(dst, '/'), *name = (slash != NULL ? slash + 1 : dst);
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    while (*name != '\0')
+    {
+        h ^= (unsigned char)*name++;
+        h *= 1099511628211ULL;
+    }
+    snprintf(tmp, size, "%.*s/%s%016llx", (slash != NULL ? (int)(slash - dst) : 0), dst, prefix, (unsigned long long)h);
+}
+
+static void tmp_name(const char *dst, char *tmp, size_t size)
+{
+    hidden_name(dst, TMP_PREFIX, tmp, size);
+}
+
+static int open_replacement(const char *dst, off_t size, bool preallocate, replacement *r)
+{
+    char dir[PATH_MAX];
+    const char *slash = strrchr(dst, '/');
+    snprintf(dir, sizeof(dir), "%.*s", slash != NULL ? (int)(slash - dst) : 1, slash != NULL ? dst : ".");
+    r->fd = (atomic_load(&tmpfile_unusable) ? -1 : open(dir, O_RDWR | O_TMPFILE | O_CLOEXEC, 0644)); // O_RDWR: zawartość można przepisać, gdy linkat zawiedzie
+    r->anonymous = (r->fd != -1);
+    if (r->fd == -1) // O_TMPFILE nieobsługiwane, użyj ukrytego pliku w tym samym katalogu
+    {
+        tmp_name(dst, r->tmp, sizeof(r->tmp));
+        r->fd = open(r->tmp, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0644);
+        if (r->fd == -1) return -1;
+    }
+    if (preallocate && size > 0) fallocate(r->fd, 0, 0, size); // ciągły przydział bloków, błąd nie przerywa kopiowania
+    return r->fd;
+}
+
+static void discard_replacement(replacement *r)
+{
+    close(r->fd);
+    if (!r->anonymous) unlink(r->tmp);
+}
+
+static int sync_parent(const char *path) // utrwal wpis katalogu po podmianie
+{
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    snprintf(dir, sizeof(dir), "%.*s", slash != NULL ? (int)(slash - path) : 1, slash != NULL ? path : ".");
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    int res = fsync(fd);
+    close(fd);
+    return res;
+}
+
+static int publish_file(const char *tmp, const char *dst) // podmień plik zapisany pod ukrytą nazwą
+{
+    if (fsync_files)
+    {
+        int fd = open(tmp, O_WRONLY | O_CLOEXEC);
+        int res = (fd == -1 ? -1 : fsync(fd));
+        if (fd != -1) close(fd);
+        if (res != 0)
+        {
+            unlink(tmp);
+            return -3;
+        }
+    }
+    if (rename(tmp, dst) != 0)
+    {
+        unlink(tmp);
+        return -3;
+    }
+    if (fsync_files) sync_parent(dst);
+    return 0;
+}
+
+static int name_by_copy(int fd, const char *tmp) // przepisz zawartość pliku O_TMPFILE do pliku o ukrytej nazwie
+{
+    char *buffer = get_copy_buffer(COPY_CHUNK);
+    int out = open(tmp, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0644);
+    if (buffer == NULL || out == -1)
+    {
+        if (out != -1) close(out);
+        return -1;
+    }
+    off_t off = 0;
+    ssize_t n;
+    while ((n = pread(fd, buffer, COPY_CHUNK, off)) > 0)
+    {
+        if (write(out, buffer, n) != n) break;
+        off += n;
+    }
+    int res = (n == 0 && (!fsync_files || fsync(out) == 0) ? 0 : -1);
+    close(out);
+    if (res != 0) unlink(tmp);
+    return res;
+}
+
+static int publish_replacement(replacement *r, const char *dst) // atomowo zastąp plik docelowy nową zawartością
+{
+    if (fsync_files && fsync(r->fd) != 0)
+    {
+        discard_replacement(r);
+        return -3;
+    }
+    if (r->anonymous) // nadaj nazwę plikowi O_TMPFILE, linkat nie nadpisuje istniejącej nazwy
+    {
+        char proc[64];
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", r->fd);
+        tmp_name(dst, r->tmp, sizeof(r->tmp));
+        unlink(r->tmp);
+        if (linkat(AT_FDCWD, proc, AT_FDCWD, r->tmp, AT_SYMLINK_FOLLOW) != 0) // np. brak /proc, kolejne kopie od razu pod ukrytą nazwą
+        {
+            if (!atomic_exchange(&tmpfile_unusable, true)) log_printf(LOG_LEVEL_WARNING, "Couldn't link an O_TMPFILE file (%s), using named temporary files\n", strerror(errno));
+            if (name_by_copy(r->fd, r->tmp) != 0)
+            {
+                close(r->fd);
+                return -3;
+            }
+        }
+        r->anonymous = false;
+    }
+    close(r->fd);
+    if (rename(r->tmp, dst) != 0)
+    {
+        unlink(r->tmp);
+        return -3;
+    }
+    if (fsync_files) sync_parent(dst);
+    return 0;
+}
+
+int copy_rw(const char *src_ent_path, const char *dst_ent_path, hash_state *hs, size_t chunk)
 {
+    struct stat st;
     int src_fd, dst_fd;
     ssize_t size_src, size_dst;
+    replacement r;
 
     src_fd = open(src_ent_path, O_RDONLY);
     if (src_fd == -1)
     {
         return -1;
     }
-    dst_fd = open(dst_ent_path, O_WRONLY | O_TRUNC | O_CREAT, 0644);
-    if (src_fd == -1) 
+    fstat(src_fd, &st);
+    dst_fd = open_replacement(dst_ent_path, st.st_size, true, &r);
+    if (dst_fd == -1)
     {
         close(src_fd);
         return -2;
     }
 
-    int BUF_SIZE = 16384;
-    char *buffer = (char*)malloc(BUF_SIZE);
+    char *buffer = get_copy_buffer(chunk);
+    if (buffer == NULL)
+    {
+        close(src_fd);
+        discard_replacement(&r);
+        return -3;
+    }
 
-    while ((size_src = read(src_fd, buffer, BUF_SIZE)) > 0)
+    while ((size_src = read(src_fd, buffer, chunk)) > 0)
     {
+        if (hs != NULL) hash_update(hs, buffer, size_src); // skrót liczony z danych, które i tak przechodzą przez bufor
         size_dst = write(dst_fd, buffer, (ssize_t)size_src);
         if (size_dst != size_src)
         {
             close(src_fd);
-            close(dst_fd);
-            free(buffer);
+            discard_replacement(&r);
             return -3;
         }
+        throttle_bytes(size_dst);
     }
 
     close(src_fd);
-    close(dst_fd);
-    free(buffer);
-    return 0;
+    if (size_src < 0)
+    {
+        discard_replacement(&r);
+        return -1;
+    }
+    return publish_replacement(&r, dst_ent_path);
+}
+
+#define MMAP_WINDOW (64 * 1024 * 1024) // odwzorowywana naraz część źródła, wielokrotność rozmiaru strony
+
+static bool mostly_cached(void *addr, size_t len) // czy okno było w pamięci podręcznej przed kopiowaniem
+{
+    static __thread unsigned char vec[MMAP_WINDOW / 4096];
+    long page = sysconf(_SC_PAGESIZE);
+    size_t pages = (len + page - 1) / page, resident = 0, i;
+    if (pages > sizeof(vec) || mincore(addr, len, vec) != 0) return false;
+    for (i = 0; i < pages; i++) resident += (vec[i] & 1);
+    return resident * 2 > pages;
 }
 
-int copy_mmap(const char *src_ent_path, const char *dst_ent_path)
+int copy_mmap(const char *src_ent_path, const char *dst_ent_path, hash_state *hs)
 {
     struct stat st;
     int src_fd, dst_fd;
-    char *buffer;
-    ssize_t size_dst;
+    off_t done = 0, flushed = 0;
+    replacement r;
     
     src_fd = open(src_ent_path, O_RDONLY);
     if (src_fd == -1)
     {
         return -1;
     }
-    dst_fd = open(dst_ent_path, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+    fstat(src_fd, &st);
+    dst_fd = open_replacement(dst_ent_path, st.st_size, true, &r);
     if (dst_fd == -1)
     {
         close(src_fd);
         return -2;
     }
 
-    fstat(src_fd, &st);
-    buffer = mmap(0, st.st_size, PROT_READ, MAP_SHARED, src_fd, 0);
-    size_dst = write(dst_fd, buffer, st.st_size);
+    // źródło odwzorowywane kolejnymi oknami, więc duży plik nie zajmuje przestrzeni adresowej ani pamięci podręcznej
+    // w całości; strony źródła, których nie było w pamięci, i zapisane już strony celu są od razu zwalniane
+    posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    size_t len = (st.st_size < MMAP_WINDOW ? st.st_size : MMAP_WINDOW);
+    char *window = (len > 0 ? mmap(NULL, len, PROT_READ, MAP_SHARED, src_fd, 0) : MAP_FAILED);
+    bool cached = (window != MAP_FAILED && mostly_cached(window, len));
+    while (window != MAP_FAILED)
+    {
+        // następne okno odwzorowane i sprawdzone przed wczytaniem go w tle, inaczej wyglądałoby na obecne w pamięci
+        off_t next = done + len;
+        size_t next_len = (st.st_size - next < MMAP_WINDOW ? st.st_size - next : MMAP_WINDOW), off = 0;
+        char *next_window = (next_len > 0 ? mmap(NULL, next_len, PROT_READ, MAP_SHARED, src_fd, next) : MAP_FAILED);
+        bool next_cached = (next_window != MAP_FAILED && mostly_cached(next_window, next_len));
+        madvise(window, len, MADV_SEQUENTIAL);
+        if (next_window != MAP_FAILED) readahead(src_fd, next, next_len);
+        if (hs != NULL) hash_update(hs, window, len);
+        size_t chunk = (throttle_limited() ? THROTTLE_CHUNK : len); // przy ograniczeniu zapisuj w porcjach, żeby nie przekraczać limitu
+        while (off < len)
+        {
+            ssize_t size_dst = write(dst_fd, window + off, (len - off < chunk ? len - off : chunk));
+            if (size_dst < 0 && errno == EINTR) continue;
+            if (size_dst <= 0) break;
+            off += size_dst;
+            throttle_bytes(size_dst);
+        }
+        munmap(window, len);
+        if (!cached) posix_fadvise(src_fd, done, len, POSIX_FADV_DONTNEED);
+        sync_file_range(dst_fd, done, off, SYNC_FILE_RANGE_WRITE); // rozpocznij zapis okna na dysk
+        if (flushed < done) // poprzednie okna: poczekaj na zapis i zwolnij ich strony, ostatnie okno zapisze się w tle
+        {
+            sync_file_range(dst_fd, flushed, done - flushed, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(dst_fd, flushed, done - flushed, POSIX_FADV_DONTNEED);
+            flushed = done;
+        }
+        done += off;
+        if (off != len) // błąd zapisu
+        {
+            if (next_window != MAP_FAILED) munmap(next_window, next_len);
+            break;
+        }
+        window = next_window;
+        len = next_len;
+        cached = next_cached;
+    }
 
     close(src_fd);
-    close(dst_fd);
-    return 0;
+    if (done != st.st_size) // niepełna zawartość nie może zastąpić pliku docelowego
+    {
+        discard_replacement(&r);
+        return -3;
+    }
+    return publish_replacement(&r, dst_ent_path);
 }
 
-void copy_file(const char *src, const char *dst, bool use_mmap)
+
+const char *copy_method_name(copy_method method)
 {
-    int res = (use_mmap ? copy_mmap(src, dst) : copy_rw(src, dst));
-    switch (res)
+    switch (method)
     {
-        case 0:
-            writeToLog("File copied\n");
-            break;
-        case -1:
-            writeToLog("Source file couldn't be opened\n");
-            return;
-        case -2:
-            writeToLog("Destination file couldn't be opened\n");
-            return;
-        case -3:
-            writeToLog("Error while writing to file\n");
-            return;
-        default:
-            writeToLog("Couldn't copy file\n");
-            return;
+        case CM_RW: return "read/write";
+        case CM_MMAP: return "mmap";
+        case CM_CLONE: return "reflink";
+        case CM_COPY_RANGE: return "copy_file_range";
+        case CM_SENDFILE: return "sendfile";
+        case CM_URING: return "io_uring";
+        case CM_DELTA: return "delta";
+        case CM_SPARSE: return "sparse";
+        case CM_LINK: return "hard link";
+    }
+    return "unknown";
+}
+
+#define KERNEL_CHUNK (64 * 1024 * 1024)
+
+static int copy_kernel_fd(int src_fd, int dst_fd, off_t size, copy_method *method) // kopiowanie bez udziału bufora w przestrzeni użytkownika
+{
+    if (ioctl(dst_fd, FICLONE, src_fd) == 0) // współdzielenie bloków (btrfs, XFS)
+    {
+        *method = CM_CLONE;
+        return 0;
     }
-    time_t src_mtime = get_mtime(src);
-    if (set_mtime(dst, src_mtime) != 0) 
+    if (size > 0) fallocate(dst_fd, 0, 0, size);
+
+    size_t chunk = (throttle_limited() ? THROTTLE_CHUNK : KERNEL_CHUNK);
+    off_t copied = 0;
+    while (copied < size)
     {
-        writeToLog("Failed to change modification time\n");
-        return;
+        ssize_t n = copy_file_range(src_fd, NULL, dst_fd, NULL, chunk, 0);
+        if (n == 0) break;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (copied == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) break;
+            return -3;
+        }
+        copied += n;
+        throttle_bytes(n);
+    }
+    if (copied > 0 || size == 0)
+    {
+        *method = CM_COPY_RANGE;
+        return 0;
+    }
+
+    while (copied < size)
+    {
+        ssize_t n = sendfile(dst_fd, src_fd, NULL, chunk);
+        if (n == 0) break;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            if (copied == 0 && (errno == EINVAL || errno == ENOSYS)) return -4;
+            return -3;
+        }
+        copied += n;
+        throttle_bytes(n);
     }
-    writeToLog("Modification time changed\n");
+    *method = CM_SENDFILE;
+    return 0;
 }
 
-void copy_directory(const char *src, const char *dst, off_t size_threshold)
+int copy_kernel(const char *src_ent_path, const char *dst_ent_path, copy_method *method)
 {
-    if (mkdir(dst, 0644) != 0) // spróbuj utworzyć katalog docelowy
+    struct stat st;
+    int src_fd, dst_fd;
+    replacement r;
+
+    src_fd = open(src_ent_path, O_RDONLY);
+    if (src_fd == -1)
     {
-        writeToLog("Couldn't create a directory at the destination\n");
-        return;
+        return -1;
     }
-    writeToLog("Directory created\n");
-    
-    DIR *src_dir = opendir(src); // otwórz katalog źródłowy
-    if (src_dir == NULL)
+    if (fstat(src_fd, &st) != 0)
     {
-        char str[PATH_MAX + 30];
-        snprintf(str, sizeof(str), "Failed opening directory (%s)\n", src);
-        writeToLog(str);
-        return;
+        close(src_fd);
+        return -1;
+    }
+    dst_fd = open_replacement(dst_ent_path, st.st_size, false, &r); // copy_kernel_fd przydziela miejsce dopiero, gdy reflink się nie uda
+    if (dst_fd == -1)
+    {
+        close(src_fd);
+        return -2;
     }
 
-    struct dirent *src_ent;
-    while ((src_ent = readdir(src_dir)) != NULL) // przeglądaj elementy w katalogu źródłowym
+    int res = copy_kernel_fd(src_fd, dst_fd, st.st_size, method);
+
+    close(src_fd);
+    if (res != 0)
     {
-        if (strcmp(src_ent->d_name, ".") == 0 || strcmp(src_ent->d_name, "..") == 0) continue;
-        
-        char src_ent_path[PATH_MAX], dst_ent_path[PATH_MAX];
-        snprintf(src_ent_path, sizeof(src_ent_path), "%s/%s", src, src_ent->d_name); // ścieżka elementu źródłowego
-        snprintf(dst_ent_path, sizeof(dst_ent_path), "%s/%s", dst, src_ent->d_name); // ścieżka elementu docelowego
+        discard_replacement(&r);
+        return res;
+    }
+    return publish_replacement(&r, dst_ent_path);
+}
 
-        if (src_ent->d_type == DT_DIR) // element źródłowy jest katalogiem
-        {
-            copy_directory(src_ent_path, dst_ent_path, size_threshold);
-        }
-        else if (src_ent->d_type == DT_REG) // element źródłowy jest zwykłym plikiem
-        {
-            off_t src_size = get_size(src_ent_path);
-            copy_file(src_ent_path, dst_ent_path, src_size > size_threshold);
-        }
+#define DELTA_BLOCK (64 * 1024)
+#define DELTA_CHUNK (16 * DELTA_BLOCK)
+
+static int write_range(int fd, const char *buf, size_t len, off_t off)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+        off += n;
+        throttle_bytes(n);
     }
-    closedir(src_dir);
+    return 0;
 }
 
-void compare_directories(const char *src, const char *dst, bool recursive, off_t size_threshold)
+int copy_delta(const char *src_ent_path, const char *dst_ent_path, off_t *written, hash_state *hs) // nadpisz w miejscu tylko bloki różniące się od źródła
 {
-    DIR *src_dir = opendir(src); // otwórz katalog źródłowy
-    if (src_dir == NULL)
+    struct stat src_st, dst_st;
+    int src_fd, dst_fd;
+
+    *written = 0;
+    dst_fd = open(dst_ent_path, O_RDWR);
+    if (dst_fd == -1) return -4; // brak pliku docelowego, zwykłe kopiowanie
+    if (fstat(dst_fd, &dst_st) != 0 || !S_ISREG(dst_st.st_mode))
     {
-        char str[PATH_MAX + 30];
-        snprintf(str, sizeof(str), "Failed opening directory (%s)\n", src);
-        writeToLog(str);
-        return;
+        close(dst_fd);
+        return -4;
     }
-    struct dirent *src_ent;
-    while ((src_ent = readdir(src_dir)) != NULL) // przeglądaj zawartość katalogu źródłowego
+    src_fd = open(src_ent_path, O_RDONLY);
+    if (src_fd == -1 || fstat(src_fd, &src_st) != 0)
     {
-        if (strcmp(src_ent->d_name, ".") == 0 || strcmp(src_ent->d_name, "..") == 0) continue;
-        
-        char src_ent_path[PATH_MAX], dst_ent_path[PATH_MAX];
-        snprintf(src_ent_path, sizeof(src_ent_path), "%s/%s", src, src_ent->d_name); // ścieżka elementu źródłowego
-        snprintf(dst_ent_path, sizeof(dst_ent_path), "%s/%s", dst, src_ent->d_name); // ścieżka elementu docelowego
-              
-        time_t src_mtime = get_mtime(src_ent_path);
-        char ts[32];
-        strftime(ts, sizeof(ts), "%Y/%m/%d %H:%M:%S", localtime(&src_mtime));
-        char str[PATH_MAX + 40];
-        snprintf(str, sizeof(str), "%s \"%s\"", ts, src_ent_path);
-
-        if (recursive && src_ent->d_type == DT_DIR) // element źródłowy jest katalogiem
-        {
-            char s[PATH_MAX + 40];
-            snprintf(s, sizeof(s), "D: %s\n", str);
-            writeToLog(s);
-            file_type dst_ft = get_file_type(dst_ent_path); // sprawdź typ elementu w katalogu docelowym
-            switch (dst_ft)
-            {
-                case FT_DIRECTORY: // podkatalog docelowy istnieje
-                    writeToLog("Destination directory exists\n");
-                    compare_directories(src_ent_path, dst_ent_path, true, size_threshold);
-                    break;
-                case FT_NONE: // podkatalog docelowy nie istnieje
-                    writeToLog("Destination directory doesn't exist\n");
-                    copy_directory(src_ent_path, dst_ent_path, size_threshold);
-                    break;
-                default: // element docelowy jest innego typu niż element źródłowy
-                    writeToLog("Other type named like the source directory exists at the destination\n");
-                    break;
-            }
+        if (src_fd != -1) close(src_fd);
+        close(dst_fd);
+        return -1;
+    }
+
+    char *src_buf = malloc(DELTA_CHUNK), *dst_buf = malloc(DELTA_CHUNK);
+    int res = (src_buf != NULL && dst_buf != NULL ? 0 : -3);
+    off_t off = 0;
+    while (res == 0 && off < src_st.st_size)
+    {
+        ssize_t n = pread(src_fd, src_buf, DELTA_CHUNK, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0)
+        {
+            res = (n == 0 ? 0 : -1);
+            break;
         }
-        else if (src_ent->d_type == DT_REG) // element źródłowy jest zwykłym plikiem
+        if (hs != NULL) hash_update(hs, src_buf, n);
+        // część istniejąca w pliku docelowym jest porównywana, reszta (np. dopisany koniec) zapisywana w całości
+        ssize_t m = 0;
+        if (off < dst_st.st_size)
         {
-            off_t src_size = get_size(src_ent_path);
-            char s[PATH_MAX + 40];
-            snprintf(s, sizeof(s), "F: %s size: %llu (%s)\n", str, (unsigned long long)src_size, (src_size <= size_threshold ? "doesn't exceed threshold" : "exceeds threshold"));
-            writeToLog(s);
-            file_type dst_ft = get_file_type(dst_ent_path); // sprawdź typ elementu w katalogu docelowym
-            switch (dst_ft)
+            m = pread(dst_fd, dst_buf, n, off);
+            if (m < 0) m = 0;
+        }
+        ssize_t pos = 0, start = -1;
+        while (pos < n)
+        {
+            ssize_t len = (n - pos < DELTA_BLOCK ? n - pos : DELTA_BLOCK);
+            bool same = (pos + len <= m && memcmp(src_buf + pos, dst_buf + pos, len) == 0);
+            if (!same && start < 0) start = pos;
+            if (same && start >= 0) // zapisz zebrany ciąg różniących się bloków
             {
-                case FT_REGULAR: // plik docelowy istnieje
-                    {
-                        time_t dst_mtime = get_mtime(dst_ent_path);
-                        snprintf(str, sizeof(str), "File exists at the destination (%s)\n", (dst_mtime == src_mtime ? "same modification time" : "different modification time"));
-                        writeToLog(str);
-                        if (dst_mtime == src_mtime) break; //daty modyfikacji nie różnią się od siebie
-                        copy_file(src_ent_path, dst_ent_path, src_size > size_threshold);
-                    }
-                    break;
-                case FT_NONE: // plik docelowy nie istnieje
-                    writeToLog("File doesn't exist at the destination\n");
-                    copy_file(src_ent_path, dst_ent_path, src_size > size_threshold);
-                    break;
-                default: // element docelowy jest innego typu niż element źródłowy
-                    writeToLog("Other type named like the source file exists at the destination\n");
-                    break;
+                if (write_range(dst_fd, src_buf + start, pos - start, off + start) != 0) res = -3;
+                *written += pos - start;
+                start = -1;
             }
+            pos += len;
+        }
+        if (start >= 0)
+        {
+            if (write_range(dst_fd, src_buf + start, n - start, off + start) != 0) res = -3;
+            *written += n - start;
         }
+        off += n;
     }
-    closedir(src_dir);
+    if (res == 0 && dst_st.st_size > src_st.st_size && ftruncate(dst_fd, src_st.st_size) != 0) res = -3; // plik źródłowy się skrócił
+
+    free(src_buf);
+    free(dst_buf);
+    close(src_fd);
+    close(dst_fd);
+    return res;
 }
 
-int remove_directory(const char *path)
-{
-    char str[PATH_MAX + 30];
-    snprintf(str, sizeof(str), "Directory to remove: %s\n", path);
-    writeToLog(str);
+#define SPARSE_CHUNK (1024 * 1024)
 
-    DIR *dir = opendir(path); // otwórz katalog do usunięcia
-    if (dir == NULL) return -1;
+static bool sparse_candidate(const struct stat *st) // tylko pliki z mniejszą liczbą przydzielonych bloków niż rozmiar, gęste pliki zostają w zwykłych ścieżkach (także we wsadzie io_uring)
+{
+    return (off_t)st->st_blocks * 512 < st->st_size;
+}
 
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) // przeglądaj elementy w katalogu do usunięcia
+static int copy_extent(int src_fd, int dst_fd, off_t off, off_t end, bool kernel_copy)
+{
+    off_t chunk = (throttle_limited() ? THROTTLE_CHUNK : end - off);
+    while (off < end && kernel_copy) // kopiowanie w jądrze, bez bufora
     {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
-
-        char ent_path[PATH_MAX];
-        snprintf(ent_path, sizeof(ent_path), "%s/%s", path, ent->d_name); // ścieżka elementu
-
-        switch (ent->d_type) // sprawdź typ elementu
-        {
-            case DT_DIR: // katalog
-                {
-                    int res = remove_directory(ent_path);
-                    if (res != 0)
-                    {
-                        closedir(dir);
-                        return res;
-                    }
-                }
-                break;
-            case DT_REG: // zwykły plik
-                snprintf(str, sizeof(str), "File to remove: %s\n", ent_path);
-                writeToLog(str);
-                if (remove(ent_path) == 0) writeToLog("Destination file removed\n");
-                else
-                {
-                    closedir(dir);
-                    return -3;
-                }
-                break;
-            default: // inny typ pliku
-                snprintf(str, sizeof(str), "Other type in directory to remove: %s\n", ent_path);
-                writeToLog(str);
-                closedir(dir);
-                return -2;
-        }
+        loff_t in = off, out = off;
+        ssize_t n = copy_file_range(src_fd, &in, dst_fd, &out, (end - off < chunk ? end - off : chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        off += n;
+        throttle_bytes(n);
+    }
+    char *buffer = (off < end ? get_copy_buffer(SPARSE_CHUNK) : NULL);
+    if (off < end && buffer == NULL) return -3;
+    while (off < end)
+    {
+        ssize_t n = pread(src_fd, buffer, (end - off < SPARSE_CHUNK ? end - off : SPARSE_CHUNK), off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        if (write_range(dst_fd, buffer, n, off) != 0) return -3;
+        off += n;
     }
-    closedir(dir);
-    if (remove(path) != 0) return -3;
     return 0;
 }
 
-void remove_extras(const char *src, const char *dst, bool recursive)
+int copy_sparse(const char *src_ent_path, const char *dst_ent_path, bool kernel_copy, copy_method *method) // kopiuj tylko zajęte zakresy, dziury odtwarzane przez ftruncate
 {
-    DIR *dst_dir = opendir(dst); // otwórz katalog docelowy
-    if (dst_dir == NULL)
+    struct stat st;
+    int src_fd, dst_fd;
+
+    src_fd = open(src_ent_path, O_RDONLY);
+    if (src_fd == -1)
     {
-        char str[PATH_MAX + 30];
-        snprintf(str, sizeof(str), "Failed opening directory (%s)\n", dst);
-        writeToLog(str);
-        return;
+        return -1;
+    }
+    if (fstat(src_fd, &st) != 0)
+    {
+        close(src_fd);
+        return -1;
+    }
+    off_t first_hole = lseek(src_fd, 0, SEEK_HOLE);
+    if (first_hole == -1 || first_hole >= st.st_size) // brak dziur lub system plików ich nie zgłasza
+    {
+        close(src_fd);
+        return -4;
     }
-    struct dirent *dst_ent;
-    while ((dst_ent = readdir(dst_dir)) != NULL) // przeglądaj elementy w katalogu docelowym
+    replacement r;
+    dst_fd = open_replacement(dst_ent_path, st.st_size, false, &r);
+    if (dst_fd == -1)
     {
-        if (strcmp(dst_ent->d_name, ".") == 0 || strcmp(dst_ent->d_name, "..") == 0) continue;
+        close(src_fd);
+        return -2;
+    }
 
-        char src_ent_path[PATH_MAX], dst_ent_path[PATH_MAX];
-        snprintf(src_ent_path, sizeof(src_ent_path), "%s/%s", src, dst_ent->d_name); // ścieżka elementu źródłowego
-        snprintf(dst_ent_path, sizeof(dst_ent_path), "%s/%s", dst, dst_ent->d_name); // ścieżka elementu docelowego
-
-        time_t t = get_mtime(dst_ent_path);
-        char ts[32];
-        strftime(ts, sizeof(ts), "%Y/%m/%d %H:%M:%S", localtime(&t));
-        char str[PATH_MAX + 40];
-        snprintf(str, sizeof(str), "%s \"%s\"\n", ts, dst_ent_path);
-
-        if (recursive && dst_ent->d_type == DT_DIR) // element docelowy jest katalogiem
-        {
-            char s[PATH_MAX + 40] = "D: ";
-            strcat(s, str);
-            writeToLog(s);
-            file_type src_ft = get_file_type(src_ent_path); // sprawdź typ elementu w katalogu źródłowym
-            switch (src_ft)
-            {
-                case FT_DIRECTORY: // podkatalog istnieje w katalogu źródłowym
-                    writeToLog("Source directory exists\n");
-                    remove_extras(src_ent_path, dst_ent_path, true);
-                    break;
-                case FT_NONE: // podkatalog nie istnieje w katalogu źródłowym
-                    {
-                        writeToLog("Source directory doesn't exist\n");
-                        int res = remove_directory(dst_ent_path);
-                        if (res == 0) snprintf(s, sizeof(s), "Directory removed (%s)\n", dst_ent_path);
-                        else if (res == -1) snprintf(s, sizeof(s), "Failed removing directory (%s), couldn't open directory\n", dst_ent_path);
-                        else if (res == -2) snprintf(s, sizeof(s), "Failed removing directory (%s), other file type exists in the directory\n", dst_ent_path);
-                        else if (res == -3) snprintf(s, sizeof(s), "Failed removing directory (%s)\n", dst_ent_path);
-                        writeToLog(s);
-                    }
-                    break;
-                default: // element innego typu istnieje w katalogu źródłowym
-                    writeToLog("Other type named like the destination directory exists at the source\n");
-                    if (remove_directory(dst_ent_path) == 0) writeToLog("Destination directory removed\n");
-                    else writeToLog("Failed to remove destination directory\n");
-                    break;
-            }
-        }
-        else if (dst_ent->d_type == DT_REG) // element docelowy jest zwykłym plikiem
+    int res = 0;
+    if (kernel_copy && ioctl(dst_fd, FICLONE, src_fd) == 0) *method = CM_CLONE; // współdzielenie bloków zachowuje dziury
+    else
+    {
+        *method = CM_SPARSE;
+        if (ftruncate(dst_fd, st.st_size) != 0) res = -3; // cały plik docelowy jest na początku jedną dziurą
+        off_t off = 0;
+        while (res == 0 && off < st.st_size)
         {
-            char s[PATH_MAX + 40] = "F: ";
-            strcat(s, str);
-            writeToLog(s);
-            file_type src_ft = get_file_type(src_ent_path); // sprawdź typ elementu w katalogu źródłowym
-            switch (src_ft)
+            off_t data = lseek(src_fd, off, SEEK_DATA);
+            if (data == -1)
             {
-                case FT_REGULAR: // plik źródłowy istnieje
-                    writeToLog("Source file exists\n");
-                    break;
-                case FT_NONE: // plik źródłowy nie istnieje
-                    writeToLog("Source file doesn't exist\n");
-                    if (remove(dst_ent_path) == 0) writeToLog("Destination file removed\n");
-                    else writeToLog("Failed to remove destination file\n");
-                    break;
-                default: // element innego typu istnieje w katalogu źródłowym
-                    writeToLog("Other type named like the destination file exists at the source\n");
-                    if (remove(dst_ent_path) == 0) writeToLog("Destination file removed\n");
-                    else writeToLog("Failed to remove destination file\n");
-                    break;
+                if (errno != ENXIO) res = -1; // ENXIO: do końca pliku jest już tylko dziura
+                break;
             }
+            off_t hole = lseek(src_fd, data, SEEK_HOLE);
+            if (hole == -1) hole = st.st_size;
+            res = copy_extent(src_fd, dst_fd, data, hole, kernel_copy);
+            off = hole;
         }
     }
-    closedir(dst_dir);
+
+    close(src_fd);
+    if (res != 0)
+    {
+        discard_replacement(&r);
+        return res;
+    }
+    return publish_replacement(&r, dst_ent_path);
+}
+
+typedef struct link_table link_table;
+typedef struct sync_plan sync_plan;
+
+typedef struct sync_context
+{
+    const sync_options *opts;
+    size_t src_len, dst_len; // długości ścieżek katalogów głównych
+    thread_pool *pool;       // NULL w trybie jednowątkowym
+    dev_t dst_dev;           // urządzenie katalogu docelowego, klucz strojenia kopiowania
+    link_table *links;       // i-węzły o wielu nazwach (-H), NULL bez odtwarzania dowiązań
+    const char *link_dest;   // poprzednia kopia migawkowa (-P), z której dowiązywane są niezmienione pliki
+    sync_plan *plan;         // lista działań wykonywana po przejrzeniu drzewa (-p, -D), NULL przy działaniu od razu
+    rescan_table *rescan;    // terminy przeglądania katalogów (-x), NULL przegląda wszystkie w każdym cyklu
+} sync_context;
+
+static int stat_path(const char *path, struct stat *st) // stat zliczany w statystykach
+{
+    stats_count(STAT_STATS, 1);
+    return stat(path, st);
+}
+
+static int stat_fd(int fd, struct stat *st)
+{
+    stats_count(STAT_STATS, 1);
+    return fstat(fd, st);
+}
+
+static int stat_at(int dir_fd, const char *name, struct stat *st, int flags)
+{
+    stats_count(STAT_STATS, 1);
+    return fstatat(dir_fd, name, st, flags);
+}
+
+static const char *rel_path(const char *path, size_t root_len) // ścieżka względem katalogu głównego
+{
+    if (path[root_len] == '/') return path + root_len + 1;
+    return path + root_len;
+}
+
+static int64_t mtime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static int64_t ctime_ns(const struct stat *st)
+{
+    return (int64_t)st->st_ctim.tv_sec * 1000000000LL + st->st_ctim.tv_nsec;
+}
+
+static bool is_reserved_name(const char *name) // pliki pomocnicze demona w katalogu docelowym
+{
+    return strncmp(name, ".filesyncd.", 11) == 0;
+}
+
+static void record_file(const sync_context *ctx, const char *src_path, const struct stat *st, uint64_t hash, uint64_t dst_ino) // zapisz zsynchronizowany plik w indeksie
+{
+    if (ctx->opts->index == NULL) return;
+    index_record rec = { rel_path(src_path, ctx->src_len), FT_REGULAR, st->st_ino, st->st_size, mtime_ns(st), ctime_ns(st), 0, hash, dst_ino };
+    index_put(ctx->opts->index, &rec);
+}
+
+static void record_copy(const sync_context *ctx, const char *src_path, const char *dst_path, const struct stat *st, uint64_t hash) // zapisz skopiowany plik
+{
+    struct stat dst_st;
+    if (ctx->opts->index == NULL) return;
+    // skrót pliku docelowego jest wiarygodny tylko dla tego samego i-węzła
+    if (!ctx->opts->verify || stat_path(dst_path, &dst_st) != 0) record_file(ctx, src_path, st, 0, 0);
+    else record_file(ctx, src_path, st, hash, dst_st.st_ino);
+}
+
+static void record_directory(const sync_context *ctx, const char *src_path, const struct stat *src_st, const char *dst_path) // zapisz stan katalogu po synchronizacji
+{
+    if (ctx->opts->index == NULL) return;
+    // stan źródła z chwili wczytania listy: plik dodany w trakcie przeglądania zmieni czas modyfikacji względem zapisanego
+    struct stat dst_st;
+    if (stat_path(dst_path, &dst_st) != 0) return;
+    index_record rec = { rel_path(src_path, ctx->src_len), FT_DIRECTORY, src_st->st_ino, 0, mtime_ns(src_st), ctime_ns(src_st), mtime_ns(&dst_st), 0, 0 };
+    index_put(ctx->opts->index, &rec);
 }
 
-void run_filesync(const char *src, const char *dst, bool is_recursive, off_t size_threshold)
+static bool directory_unchanged(const sync_context *ctx, const char *rel, const struct stat *src_st, const struct stat *dst_st, bool *dst_trusted)
 {
-    char str[256];
-    snprintf(str, sizeof(str), "run_filesync(\"%s\", \"%s\", %s, %zu)\n", src, dst, is_recursive ? "true" : "false", size_threshold);
-    writeToLog(str);
-    writeToLog("Searching for files to remove from destination that don't exist at source\n");
-    remove_extras(src, dst, is_recursive);
-    writeToLog("Searching for files to copy from source to destination\n");
-    compare_directories(src, dst, is_recursive, size_threshold);
+    // katalog jest niezmieniony, jeśli ani jego zawartość w źródle, ani w miejscu docelowym nie zmieniła się od ostatniego cyklu
+    index_record rec;
+    *dst_trusted = false;
+    if (ctx->opts->index == NULL || !index_find(ctx->opts->index, rel, &rec) || rec.type != FT_DIRECTORY) return false;
+    if (mtime_ns(dst_st) != rec.dst_mtime_ns) return false;
+    *dst_trusted = true;
+    return src_st->st_ino == rec.ino && mtime_ns(src_st) == rec.mtime_ns && ctime_ns(src_st) == rec.ctime_ns;
+}
+
+static bool file_unchanged(const sync_context *ctx, const char *src_path, const struct stat *st) // plik nie zmienił się od ostatniej synchronizacji
+{
+    index_record rec;
+    if (!index_find(ctx->opts->index, rel_path(src_path, ctx->src_len), &rec)) return false;
+    return rec.type == FT_REGULAR && rec.ino == st->st_ino && rec.size == st->st_size && rec.mtime_ns == mtime_ns(st);
+}
+
+static bool cached_hash(const sync_context *ctx, const char *path, const struct stat *st, bool is_dst, uint64_t *hash) // skrót zapisany w indeksie dla tej samej wersji pliku
+{
+    index_record rec;
+    const char *rel = (is_dst ? rel_path(path, ctx->dst_len) : rel_path(path, ctx->src_len));
+    if (ctx->opts->index != NULL && index_find(ctx->opts->index, rel, &rec) && rec.type == FT_REGULAR && rec.hash != 0 && rec.size == st->st_size)
+    {
+        // plik docelowy ma po synchronizacji czas modyfikacji pliku źródłowego
+        if ((is_dst ? rec.dst_ino : rec.ino) == st->st_ino && rec.mtime_ns == mtime_ns(st))
+        {
+            *hash = rec.hash;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool same_content(const sync_context *ctx, const char *src, const struct stat *src_st, const char *dst, const struct stat *dst_st)
+{
+    // pliki o różnych czasach modyfikacji porównywane są skrótem zawartości
+    uint64_t src_hash, dst_hash;
+    if (src_st->st_size != dst_st->st_size) return false;
+    if (mtime_ns(src_st) == mtime_ns(dst_st))
+    {
+        uint64_t hash;
+        record_file(ctx, src, src_st, cached_hash(ctx, src, src_st, false, &hash) ? hash : 0, dst_st->st_ino);
+        return true;
+    }
+    if (!cached_hash(ctx, src, src_st, false, &src_hash) && hash_file(src, &src_hash) != 0) return false;
+    if (!cached_hash(ctx, dst, dst_st, true, &dst_hash) && hash_file(dst, &dst_hash) != 0) return false;
+    if (src_hash != dst_hash) return false;
+
+    if (set_mtime_ns(dst, &src_st->st_mtim) != 0)
+    {
+        log_printf(LOG_LEVEL_ERROR, "Failed to change modification time: %s\n", dst);
+        return true;
+    }
+    log_printf(LOG_LEVEL_DEBUG, "File content unchanged, modification time updated: %s\n", dst);
+    record_file(ctx, src, src_st, src_hash, dst_st->st_ino);
+    return true;
+}
+
+static int finish_copy(const char *src, const char *dst, const struct stat *src_st, int res, copy_method method, const struct timespec *start) // zgłoś wynik kopiowania i ustaw czas modyfikacji
+{
+    // przy wielu wątkach komunikaty różnych plików się przeplatają, więc każdy zawiera ścieżkę
+    switch (res)
+    {
+        case 0:
+            log_printf(LOG_LEVEL_DEBUG, "File copied (%s): %s\n", copy_method_name(method), dst);
+            break;
+        case -1:
+            log_printf(LOG_LEVEL_ERROR, "Source file couldn't be opened: %s\n", src);
+            return -1;
+        case -2:
+            log_printf(LOG_LEVEL_ERROR, "Destination file couldn't be opened: %s\n", dst);
+            return -1;
+        case -3:
+            log_printf(LOG_LEVEL_ERROR, "Error while writing to file: %s\n", dst);
+            return -1;
+        default:
+            log_printf(LOG_LEVEL_ERROR, "Couldn't copy file: %s\n", dst);
+            return -1;
+    }
+    if (set_mtime_ns(dst, &src_st->st_mtim) != 0) // czas modyfikacji ustawiany dopiero po zapisaniu całej zawartości
+    {
+        log_printf(LOG_LEVEL_ERROR, "Failed to change modification time: %s\n", dst);
+        return -1;
+    }
+    log_printf(LOG_LEVEL_DEBUG, "Modification time changed: %s\n", dst);
+    stats_copied(method, src_st->st_size, start);
+    return 0;
+}
+
+static bool use_delta(const sync_context *ctx, const struct stat *src_st)
+{
+    return ctx->opts->delta_threshold > 0 && src_st->st_size >= ctx->opts->delta_threshold;
+}
+
+#define RESUME_XATTR "user.filesyncd.resume"
+#define RESUME_MAGIC 0x66736463706b3032ULL // "fsdcpk02"
+#define RESUME_CHUNK (1024 * 1024)
+#define CHECKPOINT_INTERVAL (64 * 1024 * 1024) // utrwalane dane między punktami kontrolnymi
+
+typedef struct checkpoint // postęp kopii w atrybucie rozszerzonym pliku częściowego
+{
+    uint64_t magic;
+    uint64_t src_ino;
+    int64_t src_size, src_mtime_ns; // wersja pliku źródłowego, której dotyczy kopia
+    int64_t offset;                 // długość skopiowanego i utrwalonego początku
+    uint64_t prefix_hash;           // skrót tego początku
+    char name[NAME_MAX + 1];        // nazwa pliku docelowego, nazwa pliku częściowego to tylko jej skrót
+} checkpoint;
+
+static bool partial_source_exists(int src_fd, int dst_fd, const char *part) // czy plik źródłowy przerwanej kopii nadal istnieje
+{
+    checkpoint cp;
+    int fd = openat(dst_fd, part, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) return false;
+    bool found = fgetxattr(fd, RESUME_XATTR, &cp, sizeof(cp)) == sizeof(cp) && cp.magic == RESUME_MAGIC && memchr(cp.name, '\0', sizeof(cp.name)) != NULL;
+    close(fd);
+    return found && faccessat(src_fd, cp.name, F_OK, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+static bool use_resume(const sync_context *ctx, const struct stat *src_st)
+{
+    return ctx->opts->resume_threshold > 0 && src_st->st_size >= ctx->opts->resume_threshold;
+}
+
+static off_t resume_offset(int fd, const char *path, const struct stat *src_st, char *buffer, hash_state *prefix) // długość zweryfikowanego początku pliku częściowego
+{
+    checkpoint cp;
+    struct stat st;
+    if (fgetxattr(fd, RESUME_XATTR, &cp, sizeof(cp)) != sizeof(cp) || cp.magic != RESUME_MAGIC || fstat(fd, &st) != 0) return 0;
+    if (cp.src_ino != src_st->st_ino || cp.src_size != src_st->st_size || cp.src_mtime_ns != mtime_ns(src_st) || cp.offset <= 0 || cp.offset > st.st_size) return 0; // plik źródłowy zmienił się od przerwania
+    off_t done = 0;
+    ssize_t n;
+    while (done < cp.offset && (n = pread(fd, buffer, (cp.offset - done < RESUME_CHUNK ? cp.offset - done : RESUME_CHUNK), done)) > 0)
+    {
+        hash_update(prefix, buffer, n);
+        done += n;
+    }
+    if (done == cp.offset && hash_final(prefix) == cp.prefix_hash) return done;
+    log_printf(LOG_LEVEL_WARNING, "Checkpoint doesn't match the partial copy, copying from the start: %s\n", path);
+    hash_init(prefix);
+    return 0;
+}
+
+static int copy_resumable(const char *src, const char *dst, const struct stat *src_st, hash_state *hs) // kopia z punktami kontrolnymi, po przerwaniu kontynuowana w następnym cyklu
+{
+    char part[PATH_MAX];
+    hidden_name(dst, PART_PREFIX, part, sizeof(part));
+    int src_fd = open(src, O_RDONLY | O_CLOEXEC);
+    if (src_fd == -1) return -1;
+    int dst_fd = open(part, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    char *buffer = get_copy_buffer(RESUME_CHUNK);
+    if (dst_fd == -1 || buffer == NULL)
+    {
+        close(src_fd);
+        if (dst_fd != -1) close(dst_fd);
+        return (dst_fd == -1 ? -2 : -3);
+    }
+
+    hash_state prefix; // skrót skopiowanego początku, liczony dalej w trakcie kopiowania
+    hash_init(&prefix);
+    off_t done = resume_offset(dst_fd, part, src_st, buffer, &prefix), size = src_st->st_size;
+    if (done > 0) log_printf(LOG_LEVEL_INFO, "Resuming copy at %lld of %lld bytes: %s\n", (long long)done, (long long)size, dst);
+    int res = (ftruncate(dst_fd, done) == 0 ? 0 : -3); // dane za punktem kontrolnym mogły nie zostać utrwalone
+    if (res == 0 && done == 0 && size > 0) fallocate(dst_fd, 0, 0, size);
+
+    checkpoint cp = { RESUME_MAGIC, src_st->st_ino, size, mtime_ns(src_st), 0, 0, "" };
+    const char *slash = strrchr(dst, '/');
+    snprintf(cp.name, sizeof(cp.name), "%s", (slash != NULL ? slash + 1 : dst));
+    if (res == 0 && done == 0) fsetxattr(dst_fd, RESUME_XATTR, &cp, sizeof(cp), 0); // nazwa zapisana od razu, żeby plik częściowy przetrwał porządkowanie przed pierwszym punktem kontrolnym
+    off_t next = done + CHECKPOINT_INTERVAL;
+    ssize_t n = 0;
+    while (res == 0 && done < size && (n = pread(src_fd, buffer, RESUME_CHUNK, done)) > 0)
+    {
+        if (write_range(dst_fd, buffer, n, done) != 0) res = -3;
+        hash_update(&prefix, buffer, n);
+        done += n;
+        if (res == 0 && done >= next && done < size)
+        {
+            cp.offset = done;
+            cp.prefix_hash = hash_final(&prefix);
+            // punkt kontrolny zapisywany dopiero po utrwaleniu danych, które opisuje
+            if (fdatasync(dst_fd) == 0) fsetxattr(dst_fd, RESUME_XATTR, &cp, sizeof(cp), 0);
+            next = done + CHECKPOINT_INTERVAL;
+        }
+    }
+    close(src_fd);
+    if (res == 0 && done != size) res = (n < 0 ? -1 : -3);
+    if (res != 0) // plik częściowy zostaje do następnego cyklu
+    {
+        close(dst_fd);
+        return res;
+    }
+    fremovexattr(dst_fd, RESUME_XATTR);
+    close(dst_fd);
+    if (hs != NULL) *hs = prefix;
+    return publish_file(part, dst);
+}
+
+static int link_previous(const sync_context *ctx, const char *dst, const struct stat *src_st) // dowiąż plik z poprzedniej kopii migawkowej, jeśli się nie zmienił
+{
+    char prev[PATH_MAX];
+    struct stat st;
+    snprintf(prev, sizeof(prev), "%s/%s", ctx->link_dest, rel_path(dst, ctx->dst_len));
+    if (stat_path(prev, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size != src_st->st_size || mtime_ns(&st) != mtime_ns(src_st)) return -1;
+    return link(prev, dst); // błąd (np. limit dowiązań) oznacza zwykłe kopiowanie
+}
+
+int copy_file(const sync_context *ctx, const char *src, const char *dst, const struct stat *src_st, uint64_t *hash)
+{
+    bool use_mmap = src_st->st_size > ctx->opts->size_threshold;
+    copy_method method = (use_mmap ? CM_MMAP : CM_RW);
+    int res = -4;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ctx->link_dest != NULL && link_previous(ctx, dst, src_st) == 0)
+    {
+        log_printf(LOG_LEVEL_DEBUG, "File copied (%s): %s\n", copy_method_name(CM_LINK), dst);
+        stats_copied(CM_LINK, 0, &start);
+        *hash = 0;
+        return 0;
+    }
+    hash_state hs, *hsp = (ctx->opts->verify ? &hs : NULL);
+    if (hsp != NULL) hash_init(hsp);
+    throttle_file();
+    if (use_delta(ctx, src_st)) // duży plik już istnieje w miejscu docelowym, przepisz tylko zmiany
+    {
+        off_t written;
+        res = copy_delta(src, dst, &written, hsp);
+        if (res == 0) log_printf(LOG_LEVEL_DEBUG, "Delta: %lld of %lld bytes rewritten: %s\n", (long long)written, (long long)src_st->st_size, dst);
+        if (res != -4) method = CM_DELTA;
+    }
+    if (res == -4 && use_resume(ctx, src_st))
+    {
+        res = copy_resumable(src, dst, src_st, hsp);
+        method = CM_RW;
+    }
+    if (res == -4 && sparse_candidate(src_st))
+    {
+        res = copy_sparse(src, dst, ctx->opts->kernel_copy, &method);
+        if (res != -4) hsp = NULL; // dziury nie są czytane, więc skrót nie obejmuje całej zawartości
+    }
+    if (res == -4 && ctx->opts->kernel_copy)
+    {
+        res = copy_kernel(src, dst, &method);
+        if (res != -4) hsp = NULL; // dane nie przeszły przez przestrzeń użytkownika, skrót zostanie policzony przy potrzebie
+    }
+    if (res == -4 && ctx->opts->adaptive) // sposób wybrany na podstawie pomiarów dla tej pary systemów plików
+    {
+        copy_arm arm = adapt_choose(src_st->st_dev, ctx->dst_dev, src_st->st_size);
+        struct timespec copy_start;
+        clock_gettime(CLOCK_MONOTONIC, &copy_start);
+        if (arm == ARM_MMAP) res = copy_mmap(src, dst, hsp);
+        else res = copy_rw(src, dst, hsp, adapt_chunk(arm));
+        method = (arm == ARM_MMAP ? CM_MMAP : CM_RW);
+        struct timespec copy_end;
+        clock_gettime(CLOCK_MONOTONIC, &copy_end);
+        if (res == 0) adapt_record(src_st->st_dev, ctx->dst_dev, src_st->st_size, arm, (uint64_t)(copy_end.tv_sec - copy_start.tv_sec) * 1000000000ULL + copy_end.tv_nsec - copy_start.tv_nsec);
+    }
+    if (res == -4) res = (use_mmap ? copy_mmap(src, dst, hsp) : copy_rw(src, dst, hsp, COPY_CHUNK)); // jądro nie obsługuje żadnej z metod, użyj zwykłej ścieżki
+    *hash = (hsp != NULL && res == 0 ? hash_final(hsp) : 0);
+    return finish_copy(src, dst, src_st, res, method, &start);
+}
+
+typedef struct link_follower
+{
+    char *src, *dst;
+    struct stat st;
+} link_follower;
+
+typedef struct link_group // pliki źródłowe wskazujące ten sam i-węzeł
+{
+    dev_t dev;
+    ino_t ino;
+    char *dst;         // pierwsze wystąpienie, kopiowane zwykłą ścieżką; NULL oznacza wolne miejsce
+    struct stat st;
+    link_follower *followers; // kolejne wystąpienia, dowiązywane po zakończeniu kopiowania
+    size_t count, cap;
+} link_group;
+
+struct link_table
+{
+    pthread_mutex_t lock;
+    link_group *groups; // adresowanie otwarte, klucz (st_dev, st_ino)
+    size_t count, cap;
+};
+
+static link_table *links_create(void)
+{
+    link_table *t = calloc(1, sizeof(*t));
+    if (t == NULL) return NULL;
+    t->cap = 256;
+    t->groups = calloc(t->cap, sizeof(*t->groups));
+    if (t->groups == NULL)
+    {
+        free(t);
+        return NULL;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    return t;
+}
+
+static size_t link_slot(const link_group *groups, size_t cap, dev_t dev, ino_t ino)
+{
+    size_t i = (size_t)(((uint64_t)ino * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)dev) & (cap - 1);
+    while (groups[i].dst != NULL && (groups[i].dev != dev || groups[i].ino != ino)) i = (i + 1) & (cap - 1);
+    return i;
+}
+
+static bool links_grow(link_table *t)
+{
+    size_t cap = t->cap * 2, i;
+    link_group *groups = calloc(cap, sizeof(*groups));
+    if (groups == NULL) return false;
+    for (i = 0; i < t->cap; i++)
+    {
+        if (t->groups[i].dst != NULL) groups[link_slot(groups, cap, t->groups[i].dev, t->groups[i].ino)] = t->groups[i];
+    }
+    free(t->groups);
+    t->groups = groups;
+    t->cap = cap;
+    return true;
+}
+
+static bool link_later(const sync_context *ctx, const char *src, const char *dst, const struct stat *st) // true, jeśli plik zostanie dowiązany do wcześniejszego wystąpienia
+{
+    link_table *t = ctx->links;
+    if (t == NULL || st->st_nlink < 2) return false;
+    bool res = false;
+    pthread_mutex_lock(&t->lock);
+    if (t->count * 2 >= t->cap && !links_grow(t))
+    {
+        pthread_mutex_unlock(&t->lock);
+        return false;
+    }
+    link_group *g = &t->groups[link_slot(t->groups, t->cap, st->st_dev, st->st_ino)];
+    if (g->dst == NULL) // pierwsze wystąpienie i-węzła
+    {
+        g->dst = strdup(dst);
+        if (g->dst != NULL)
+        {
+            g->dev = st->st_dev;
+            g->ino = st->st_ino;
+            g->st = *st;
+            t->count++;
+        }
+    }
+    else
+    {
+        if (g->count == g->cap)
+        {
+            size_t cap = (g->cap ? g->cap * 2 : 4);
+            link_follower *followers = realloc(g->followers, cap * sizeof(*followers));
+            if (followers != NULL)
+            {
+                g->followers = followers;
+                g->cap = cap;
+            }
+        }
+        link_follower *f = (g->count < g->cap ? &g->followers[g->count] : NULL); // brak pamięci, plik zostanie skopiowany
+        if (f != NULL)
+        {
+            f->src = strdup(src);
+            f->dst = strdup(dst);
+            f->st = *st;
+            if (f->src != NULL && f->dst != NULL)
+            {
+                g->count++;
+                res = true;
+            }
+            else
+            {
+                free(f->src);
+                free(f->dst);
+            }
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    return res;
+}
+
+static void link_group_apply(const sync_context *ctx, const link_group *g)
+{
+    struct stat first_st;
+    size_t i;
+    // pierwsze wystąpienie musi mieć już zawartość źródła, inaczej dowiązania wskazywałyby starą wersję
+    bool ready = (stat_path(g->dst, &first_st) == 0 && S_ISREG(first_st.st_mode) && first_st.st_size == g->st.st_size && (ctx->opts->verify || mtime_ns(&first_st) == mtime_ns(&g->st))); // -V nie przenosi samego czasu modyfikacji
+    for (i = 0; i < g->count; i++)
+    {
+        const link_follower *f = &g->followers[i];
+        struct stat dst_st;
+        if (!ready)
+        {
+            log_printf(LOG_LEVEL_ERROR, "Couldn't link to a file that wasn't copied: %s\n", f->dst);
+            stats_count(STAT_ERRORS, 1);
+            continue;
+        }
+        if (stat_path(f->dst, &dst_st) == 0 && dst_st.st_dev == first_st.st_dev && dst_st.st_ino == first_st.st_ino)
+        {
+            log_printf(LOG_LEVEL_DEBUG, "Hard link exists at the destination: %s\n", f->dst);
+            record_file(ctx, f->src, &f->st, 0, 0);
+            continue;
+        }
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        char tmp[PATH_MAX];
+        tmp_name(f->dst, tmp, sizeof(tmp));
+        unlink(tmp);
+        if (link(g->dst, tmp) != 0 || rename(tmp, f->dst) != 0) // podmiana zachowuje stary plik do chwili utworzenia dowiązania
+        {
+            unlink(tmp);
+            log_printf(LOG_LEVEL_ERROR, "Couldn't create a hard link: %s\n", f->dst);
+            stats_count(STAT_ERRORS, 1);
+            continue;
+        }
+        log_printf(LOG_LEVEL_DEBUG, "File copied (%s): %s\n", copy_method_name(CM_LINK), f->dst);
+        stats_copied(CM_LINK, 0, &start);
+        record_file(ctx, f->src, &f->st, 0, 0);
+    }
+}
+
+static void links_finish(sync_context *ctx) // utwórz dowiązania, gdy wszystkie kopie są już gotowe
+{
+    link_table *t = ctx->links;
+    if (t == NULL) return;
+    size_t i, j;
+    for (i = 0; i < t->cap; i++)
+    {
+        link_group *g = &t->groups[i];
+        if (g->dst == NULL) continue;
+        link_group_apply(ctx, g);
+        for (j = 0; j < g->count; j++)
+        {
+            free(g->followers[j].src);
+            free(g->followers[j].dst);
+        }
+        free(g->followers);
+        free(g->dst);
+    }
+    pthread_mutex_destroy(&t->lock);
+    free(t->groups);
+    free(t);
+    ctx->links = NULL;
+}
+
+typedef enum action_kind // kolejność wykonania: usunięcia, nowe katalogi, kopie, czasy katalogów, zapis stanu katalogów w indeksie
+{
+    ACT_REMOVE,
+    ACT_MKDIR,
+    ACT_COPY,
+    ACT_MTIME,
+    ACT_RECORD
+} action_kind;
+
+typedef struct action
+{
+    action_kind kind;
+    char *src, *dst;
+    struct stat st;
+    uint64_t offset; // położenie pierwszego zakresu pliku na dysku, gdy mapped
+    bool mapped;     // FIEMAP podał położenie; bez niego kolejność według numeru i-węzła
+    bool is_dir;
+} action;
+
+struct sync_plan
+{
+    pthread_mutex_t lock;
+    action *items;
+    size_t count, cap;
+    bool dry_run;        // tylko raport, bez zmian w miejscu docelowym
+    atomic_bool failed;  // nieudane działanie, stan katalogów nie jest zapisywany w indeksie
+};
+
+static sync_plan *plan_create(bool dry_run)
+{
+    sync_plan *p = calloc(1, sizeof(*p));
+    if (p == NULL) return NULL;
+    pthread_mutex_init(&p->lock, NULL);
+    p->dry_run = dry_run;
+    return p;
+}
+
+static bool physical_offset(const char *path, uint64_t *offset) // kopie ustawiane w kolejności położenia danych źródła
+{
+    struct
+    {
+        struct fiemap map;
+        struct fiemap_extent extent;
+    } req;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+    memset(&req, 0, sizeof(req));
+    req.map.fm_length = FIEMAP_MAX_OFFSET;
+    req.map.fm_extent_count = 1;
+    int res = ioctl(fd, FS_IOC_FIEMAP, &req.map);
+    close(fd);
+    if (res != 0 || req.map.fm_mapped_extents == 0) return false; // np. tmpfs lub plik bez danych
+    *offset = req.extent.fe_physical;
+    return true;
+}
+
+static int plan_add(const sync_context *ctx, action_kind kind, const char *src, const char *dst, const struct stat *st, bool is_dir)
+{
+    sync_plan *p = ctx->plan;
+    action a = { kind, (src != NULL ? strdup(src) : NULL), strdup(dst), { 0 }, 0, false, is_dir };
+    if (st != NULL) a.st = *st;
+    if (kind == ACT_COPY) a.mapped = physical_offset(src, &a.offset);
+    if ((src != NULL && a.src == NULL) || a.dst == NULL)
+    {
+        free(a.src);
+        free(a.dst);
+        return -1;
+    }
+    pthread_mutex_lock(&p->lock);
+    if (p->count == p->cap)
+    {
+        size_t cap = (p->cap ? p->cap * 2 : 256);
+        action *items = realloc(p->items, cap * sizeof(*items));
+        if (items == NULL)
+        {
+            pthread_mutex_unlock(&p->lock);
+            free(a.src);
+            free(a.dst);
+            return -1;
+        }
+        p->items = items;
+        p->cap = cap;
+    }
+    p->items[p->count++] = a;
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+typedef struct dir_job // katalog, którego elementy są jeszcze przetwarzane
+{
+    struct dir_job *parent;
+    const sync_context *ctx;
+    char *src, *dst;
+    atomic_int pending; // przeglądanie katalogu i niezakończone zadania jego elementów
+    atomic_bool failed;
+    bool record; // zapisz katalog w indeksie po przetworzeniu wszystkich elementów
+    atomic_bool changed;        // skopiowano lub usunięto element (-x)
+    struct stat src_st;         // stan katalogu źródłowego w chwili wczytania jego listy
+    atomic_llong children_due;  // najbliższy termin przeglądu katalogów pod tym katalogiem (-x)
+} dir_job;
+
+typedef enum task_kind
+{
+    TASK_SYNC,
+    TASK_COPY_DIRECTORY,
+    TASK_COPY_FILE
+} task_kind;
+
+typedef struct sync_task
+{
+    task_kind kind;
+    dir_job *job; // katalog nadrzędny
+    char *src, *dst;
+    struct stat st;
+    bool recursive;
+} sync_task;
+
+static dir_job *job_start(const sync_context *ctx, dir_job *parent, const char *src, const char *dst)
+{
+    dir_job *job = malloc(sizeof(*job));
+    if (job == NULL) return NULL;
+    job->parent = parent;
+    job->ctx = ctx;
+    job->src = strdup(src);
+    job->dst = strdup(dst);
+    atomic_init(&job->pending, 1);
+    atomic_init(&job->failed, false);
+    job->record = true;
+    atomic_init(&job->changed, false);
+    memset(&job->src_st, 0, sizeof(job->src_st));
+    atomic_init(&job->children_due, LLONG_MAX);
+    if (parent != NULL) atomic_fetch_add(&parent->pending, 1);
+    return job;
+}
+
+static void lower_due(dir_job *job, time_t due)
+{
+    long long cur = atomic_load(&job->children_due);
+    while (due < cur && !atomic_compare_exchange_weak(&job->children_due, &cur, due));
+}
+
+static bool rescan_now(dir_job *job, const char *src) // podkatalog do przejrzenia w tym cyklu (-x)
+{
+    time_t due;
+    if (job->ctx->rescan == NULL || rescan_due(job->ctx->rescan, rel_path(src, job->ctx->src_len), &due)) return true;
+    lower_due(job, due);
+    return false;
+}
+
+static void job_fail(dir_job *job)
+{
+    stats_count(STAT_ERRORS, 1);
+    if (job != NULL) atomic_store(&job->failed, true);
+}
+
+static void set_directory_mtime(const char *dst, const struct stat *src_st) // po zapisaniu całej zawartości, zmiany elementów przesuwają czas katalogu
+{
+    if (set_mtime_ns(dst, &src_st->st_mtim) != 0) log_printf(LOG_LEVEL_ERROR, "Failed to change directory modification time: %s\n", dst);
+}
+
+static void job_release(dir_job *job)
+{
+    if (job == NULL || atomic_fetch_sub(&job->pending, 1) != 1) return;
+
+    // wszystkie elementy katalogu zostały przetworzone
+    const sync_context *ctx = job->ctx;
+    if (atomic_load(&job->changed) && job->src_st.st_ino != 0) // przed zapisem stanu w indeksie, który obejmuje czas katalogu docelowego
+    {
+        if (ctx->plan == NULL) set_directory_mtime(job->dst, &job->src_st);
+        else if (plan_add(ctx, ACT_MTIME, job->src, job->dst, &job->src_st, true) != 0) job_fail(job);
+    }
+    if (ctx->opts->index != NULL)
+    {
+        bool ok = !atomic_load(&job->failed);
+        // w trybie planu katalog docelowy zmieni się dopiero przy wykonaniu, jego stan zapisywany jest na końcu
+        if (ok && job->record && ctx->plan != NULL) ok = (plan_add(ctx, ACT_RECORD, job->src, job->dst, &job->src_st, true) == 0);
+        else if (ok && job->record) record_directory(ctx, job->src, &job->src_st, job->dst);
+        if (!ok || !job->record) index_invalidate(ctx->opts->index, rel_path(job->src, ctx->src_len)); // nieudane elementy muszą zostać ponownie sprawdzone
+    }
+    dir_job *parent = job->parent;
+    if (ctx->rescan != NULL) // nieudany przegląd traktowany jak zmiana, katalog zostanie przejrzany w następnym cyklu
+    {
+        time_t due = rescan_done(ctx->rescan, rel_path(job->src, ctx->src_len), mtime_ns(&job->src_st), atomic_load(&job->failed) || atomic_load(&job->changed), (time_t)atomic_load(&job->children_due));
+        if (parent != NULL) lower_due(parent, due);
+    }
+    free(job->src);
+    free(job->dst);
+    free(job);
+    job_release(parent);
+}
+
+void copy_directory(const sync_context *ctx, dir_job *parent, const char *src, const char *dst);
+void sync_directory(const sync_context *ctx, dir_job *parent, const char *src, const char *dst, bool recursive);
+
+static void run_task(void *arg)
+{
+    sync_task *t = arg;
+    const sync_context *ctx = t->job->ctx;
+    fsync_files = ctx->opts->fsync;
+    switch (t->kind)
+    {
+        case TASK_SYNC:
+            sync_directory(ctx, t->job, t->src, t->dst, t->recursive);
+            break;
+        case TASK_COPY_DIRECTORY:
+            copy_directory(ctx, t->job, t->src, t->dst);
+            break;
+        case TASK_COPY_FILE:
+        {
+            uint64_t hash;
+            if (copy_file(ctx, t->src, t->dst, &t->st, &hash) == 0) record_copy(ctx, t->src, t->dst, &t->st, hash);
+            else job_fail(t->job);
+            break;
+        }
+    }
+    job_release(t->job);
+    free(t->src);
+    free(t->dst);
+    free(t);
+}
+
+#define URING_DEPTH 128
+
+static atomic_bool uring_unavailable = false;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread uring_ctx *thread_ring = NULL;
+static __thread sync_task *uring_batch[URING_DEPTH]; // kopie czekające na wspólne wysłanie przez io_uring
+static __thread size_t uring_batch_count = 0;
+
+static void destroy_ring(void *ring)
+{
+    uring_destroy(ring);
+}
+
+static void create_ring_key(void)
+{
+    pthread_key_create(&ring_key, destroy_ring);
+}
+
+static uring_ctx *get_ring(void) // pierścień io_uring bieżącego wątku
+{
+    if (thread_ring != NULL) return thread_ring;
+    if (atomic_load(&uring_unavailable)) return NULL;
+    thread_ring = uring_create(URING_DEPTH);
+    if (thread_ring == NULL)
+    {
+        if (!atomic_exchange(&uring_unavailable, true)) log_printf(LOG_LEVEL_WARNING, "io_uring is unavailable, using regular copy\n");
+        return NULL;
+    }
+    pthread_once(&ring_key_once, create_ring_key);
+    pthread_setspecific(ring_key, thread_ring); // zwolnij pierścień po zakończeniu wątku
+    return thread_ring;
+}
+
+static void flush_uring(void) // skopiuj wszystkie zebrane pliki jednym wsadem
+{
+    size_t i, n = uring_batch_count;
+    if (n == 0) return;
+    uring_batch_count = 0;
+    uring_copy_req reqs[URING_DEPTH];
+    char (*tmp)[PATH_MAX] = malloc(n * sizeof(*tmp)); // pierścień zapisuje do ukrytych plików, podmieniane są po zakończeniu wsadu
+    for (i = 0; i < n; i++)
+    {
+        reqs[i].src = uring_batch[i]->src;
+        reqs[i].dst = uring_batch[i]->dst;
+        reqs[i].size = uring_batch[i]->st.st_size;
+        if (tmp != NULL)
+        {
+            tmp_name(uring_batch[i]->dst, tmp[i], PATH_MAX);
+            reqs[i].dst = tmp[i];
+        }
+        reqs[i].data = uring_batch[i];
+    }
+    struct timespec start; // opóźnienie każdej kopii liczone od wysłania wsadu
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uring_copy_batch(thread_ring, reqs, n);
+    bool failed = false;
+    for (i = 0; i < n; i++) failed = failed || reqs[i].result == -4;
+    if (failed) // pierścień zawiódł i został zamknięty, kolejne kopie zwykłą ścieżką
+    {
+        uring_destroy(thread_ring);
+        thread_ring = NULL;
+        pthread_setspecific(ring_key, NULL);
+        if (!atomic_exchange(&uring_unavailable, true)) log_printf(LOG_LEVEL_WARNING, "io_uring failed, using regular copy\n");
+    }
+    for (i = 0; i < n; i++)
+    {
+        sync_task *t = reqs[i].data;
+        if (reqs[i].result == -4) // pierścień zawiódł, skopiuj zwykłą ścieżką
+        {
+            if (tmp != NULL) unlink(tmp[i]); // przerwane operacje mogą jeszcze pisać do starego pliku, kopia trafi do nowego
+            run_task(t);
+            continue;
+        }
+        const sync_context *ctx = t->job->ctx;
+        if (tmp != NULL && reqs[i].result == 0) reqs[i].result = publish_file(tmp[i], t->dst);
+        else if (tmp != NULL) unlink(tmp[i]);
+        if (finish_copy(t->src, t->dst, &t->st, reqs[i].result, CM_URING, &start) == 0) record_copy(ctx, t->src, t->dst, &t->st, 0);
+        else job_fail(t->job);
+        job_release(t->job);
+        free(t->src);
+        free(t->dst);
+        free(t);
+    }
+    free(tmp);
+}
+
+static void spawn(dir_job *job, task_kind kind, const char *src, const char *dst, const struct stat *st, bool recursive) // wykonaj od razu lub zleć puli wątków
+{
+    if (kind == TASK_COPY_FILE && job->ctx->plan != NULL) // kopia trafi do planu, wykonywana po przejrzeniu całego drzewa
+    {
+        if (plan_add(job->ctx, ACT_COPY, src, dst, st, false) != 0) job_fail(job);
+        return;
+    }
+    if (kind != TASK_SYNC) atomic_store(&job->changed, true);
+    sync_task *t = malloc(sizeof(*t));
+    if (t == NULL)
+    {
+        job_fail(job);
+        return;
+    }
+    t->kind = kind;
+    t->job = job;
+    t->src = strdup(src);
+    t->dst = strdup(dst);
+    if (st != NULL) t->st = *st;
+    t->recursive = recursive;
+    atomic_fetch_add(&job->pending, 1);
+    if (kind == TASK_COPY_FILE && job->ctx->opts->io_uring && !use_delta(job->ctx, &t->st) && !use_resume(job->ctx, &t->st) && !sparse_candidate(&t->st) && !throttle_limited() && job->ctx->link_dest == NULL && get_ring() != NULL) // kopia trafi do wsadu io_uring tego wątku (wsad nie podlega ograniczeniu ruchu)
+    {
+        uring_batch[uring_batch_count++] = t;
+        if (uring_batch_count == URING_DEPTH) flush_uring();
+    }
+    else if (job->ctx->pool != NULL) pool_submit(job->ctx->pool, run_task, t);
+    else run_task(t);
+}
+
+int remove_entry_at(int dir_fd, const char *name, unsigned char type) // usuń element dowolnego typu, katalog razem z zawartością
+{
+    if (type == DT_UNKNOWN)
+    {
+        struct stat st;
+        if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return -1;
+        type = (S_ISDIR(st.st_mode) ? DT_DIR : DT_REG);
+    }
+    if (type != DT_DIR) // pliki, dowiązania symboliczne, kolejki FIFO itd.
+    {
+        if (unlinkat(dir_fd, name, 0) != 0) return -3;
+        stats_count(STAT_REMOVED, 1);
+        return 0;
+    }
+
+    int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir = (fd != -1 ? fdopendir(fd) : NULL);
+    if (dir == NULL)
+    {
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    struct dirent *ent;
+    int res = 0;
+    while (res == 0 && (ent = readdir(dir)) != NULL) // przeglądaj elementy w katalogu do usunięcia
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        res = remove_entry_at(dirfd(dir), ent->d_name, ent->d_type);
+    }
+    closedir(dir);
+    if (res != 0) return res;
+    if (unlinkat(dir_fd, name, AT_REMOVEDIR) != 0) return -3;
+    stats_count(STAT_REMOVED, 1);
+    return 0;
+}
+
+int remove_directory(const char *path)
+{
+    log_printf(LOG_LEVEL_DEBUG, "Directory to remove: %s\n", path);
+    return remove_entry_at(AT_FDCWD, path, DT_DIR);
+}
+
+static int discard_directory(const sync_context *ctx, const char *dst_path) // przenieś katalog do kosza, usuń od razu tylko gdy to niemożliwe
+{
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "%.*s", (int)ctx->dst_len, dst_path);
+    if (trash_move(root, dst_path) == 0)
+    {
+        log_printf(LOG_LEVEL_DEBUG, "Directory moved to the trash (%s)\n", dst_path);
+        return 0;
+    }
+    return remove_directory(dst_path);
+}
+
+static void forget(const sync_context *ctx, const char *dst_path, bool removed) // zaktualizuj indeks po usunięciu elementu
+{
+    if (ctx->opts->index == NULL) return;
+    if (removed) index_remove(ctx->opts->index, rel_path(dst_path, ctx->dst_len));
+    else index_invalidate(ctx->opts->index, rel_path(dst_path, ctx->dst_len));
+}
+
+typedef struct entry
+{
+    const char *name;
+    size_t name_off;
+    unsigned char type; // DT_*
+} entry;
+
+typedef struct entry_list // posortowana zawartość katalogu
+{
+    entry *items;
+    size_t count, cap;
+    char *names;
+    size_t names_len, names_cap;
+} entry_list;
+
+#define DENTS_BUF_SIZE (256 * 1024)
+
+static int add_entry(entry_list *l, const char *name, unsigned char type)
+{
+    size_t len = strlen(name) + 1;
+    if (l->count == l->cap)
+    {
+        size_t cap = l->cap ? l->cap * 2 : 64;
+        entry *items = realloc(l->items, cap * sizeof(*items));
+        if (items == NULL) return -1;
+        l->items = items;
+        l->cap = cap;
+    }
+    if (l->names_len + len > l->names_cap)
+    {
+        size_t cap = l->names_cap ? l->names_cap * 2 : 4096;
+        while (cap < l->names_len + len) cap *= 2;
+        char *names = realloc(l->names, cap);
+        if (names == NULL) return -1;
+        l->names = names;
+        l->names_cap = cap;
+    }
+    memcpy(l->names + l->names_len, name, len);
+    l->items[l->count].name_off = l->names_len;
+    l->items[l->count].type = type;
+    l->count++;
+    l->names_len += len;
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(((const entry *)a)->name, ((const entry *)b)->name);
+}
+
+static void sort_entries(entry_list *l) // nazwy są już na miejscu, więc można ustawić wskaźniki
+{
+    size_t i;
+    for (i = 0; i < l->count; i++) l->items[i].name = l->names + l->items[i].name_off;
+    qsort(l->items, l->count, sizeof(entry), compare_names);
+}
+
+static int read_entries(int fd, entry_list *l) // wczytaj cały katalog dużymi porcjami getdents64
+{
+    char *buf = malloc(DENTS_BUF_SIZE);
+    if (buf == NULL) return -1;
+    ssize_t n;
+    while ((n = getdents64(fd, buf, DENTS_BUF_SIZE)) > 0)
+    {
+        ssize_t off = 0;
+        while (off < n)
+        {
+            struct dirent64 *d = (struct dirent64 *)(buf + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+            if (add_entry(l, d->d_name, d->d_type) != 0)
+            {
+                free(buf);
+                return -1;
+            }
+        }
+    }
+    free(buf);
+    if (n < 0) return -1;
+    sort_entries(l);
+    return 0;
+}
+
+static void read_index_entries(const sync_context *ctx, const char *rel, entry_list *l) // zawartość niezmienionego katalogu według indeksu
+{
+    index_record *children;
+    size_t i, n = index_children(ctx->opts->index, rel, &children);
+    for (i = 0; i < n; i++)
+    {
+        const char *name = strrchr(children[i].path, '/');
+        name = (name == NULL ? children[i].path : name + 1);
+        add_entry(l, name, children[i].type == FT_DIRECTORY ? DT_DIR : DT_REG);
+    }
+    free(children);
+    sort_entries(l);
+}
+
+static void free_entries(entry_list *l)
+{
+    free(l->items);
+    free(l->names);
+}
+
+static unsigned char resolve_type(int dir_fd, const char *name, unsigned char type, struct stat *st, bool *have_st) // uzupełnij DT_UNKNOWN
+{
+    if (type != DT_UNKNOWN) return type;
+    if (stat_at(dir_fd, name, st, AT_SYMLINK_NOFOLLOW) != 0) return DT_UNKNOWN;
+    *have_st = true;
+    if (S_ISREG(st->st_mode)) return DT_REG;
+    if (S_ISDIR(st->st_mode)) return DT_DIR;
+    return DT_UNKNOWN;
+}
+
+static bool excluded(const sync_context *ctx, int dir_fd, const char *dir, const char *name, unsigned char type) // reguły -e sprawdzane przed stat, wykluczony katalog nie jest nawet otwierany
+{
+    const filter *f = ctx->opts->filter;
+    if (f == NULL || is_reserved_name(name)) return false;
+    char rel[PATH_MAX];
+    const char *dir_rel = rel_path(dir, ctx->src_len);
+    snprintf(rel, sizeof(rel), "%s%s%s", dir_rel, (dir_rel[0] != '\0' ? "/" : ""), name);
+    filter_result res = filter_match(f, rel, name, type, NULL);
+    if (res == FILTER_NEED_STAT) // reguła z warunkiem rozmiaru lub wieku
+    {
+        struct stat st;
+        res = (stat_at(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 ? filter_match(f, rel, name, type, &st) : FILTER_INCLUDE);
+    }
+    if (res == FILTER_EXCLUDE) log_printf(LOG_LEVEL_DEBUG, "Excluded: %s\n", rel);
+    return res == FILTER_EXCLUDE;
+}
+
+static void log_entry(char kind, const char *path, time_t mtime, const char *suffix)
+{
+    if (!log_enabled(LOG_LEVEL_DEBUG)) return;
+    struct tm tm;
+    char ts[32];
+    strftime(ts, sizeof(ts), "%Y/%m/%d %H:%M:%S", localtime_r(&mtime, &tm));
+    log_printf(LOG_LEVEL_DEBUG, "%c: %s \"%s\"%s\n", kind, ts, path, suffix);
+}
+
+static bool remove_destination(dir_job *job, int dst_fd, const char *name, unsigned char type, const char *dst_path) // usuń element docelowy bez odpowiednika w źródle
+{
+    atomic_store(&job->changed, true);
+    if (job->ctx->plan != NULL) // usunięcia z planu wykonywane razem, przed kopiowaniem
+    {
+        if (plan_add(job->ctx, ACT_REMOVE, NULL, dst_path, NULL, type == DT_DIR) == 0) return true;
+        job_fail(job);
+        return false;
+    }
+    if (type == DT_DIR)
+    {
+        int res = discard_directory(job->ctx, dst_path);
+        if (res == 0) log_printf(LOG_LEVEL_DEBUG, "Directory removed (%s)\n", dst_path);
+        else if (res == -1) log_printf(LOG_LEVEL_ERROR, "Failed removing directory (%s), couldn't open directory\n", dst_path);
+        else log_printf(LOG_LEVEL_ERROR, "Failed removing directory (%s)\n", dst_path);
+        forget(job->ctx, dst_path, res == 0);
+        if (res != 0) job_fail(job);
+        return res == 0;
+    }
+    if (unlinkat(dst_fd, name, 0) == 0)
+    {
+        log_printf(LOG_LEVEL_DEBUG, "Destination file removed\n");
+        stats_count(STAT_REMOVED, 1);
+        forget(job->ctx, dst_path, true);
+        return true;
+    }
+    log_printf(LOG_LEVEL_ERROR, "Failed to remove destination file\n");
+    job_fail(job);
+    return false;
+}
+
+static void sync_entry(dir_job *job, int src_fd, int dst_fd, const entry *s, const entry *d, bool recursive, bool dst_trusted)
+{
+    const sync_context *ctx = job->ctx;
+    const char *name = (s != NULL ? s->name : d->name);
+    // wykluczony element nie jest ani kopiowany, ani usuwany z miejsca docelowego
+    if (s != NULL ? excluded(ctx, src_fd, job->src, name, s->type) : excluded(ctx, dst_fd, job->src, name, d->type)) return;
+    stats_count(STAT_ENTRIES, 1);
+    char src_ent_path[PATH_MAX], dst_ent_path[PATH_MAX];
+    snprintf(src_ent_path, sizeof(src_ent_path), "%s/%s", job->src, name); // ścieżka elementu źródłowego
+    snprintf(dst_ent_path, sizeof(dst_ent_path), "%s/%s", job->dst, name); // ścieżka elementu docelowego
+
+    struct stat src_st, dst_st;
+    bool have_src_st = false, have_dst_st = false;
+    unsigned char src_type = (s != NULL ? resolve_type(src_fd, name, s->type, &src_st, &have_src_st) : DT_UNKNOWN);
+    unsigned char dst_type = (d != NULL ? resolve_type(dst_fd, name, d->type, &dst_st, &have_dst_st) : DT_UNKNOWN);
+    if (!recursive && src_type == DT_DIR) src_type = DT_UNKNOWN; // bez rekurencji podkatalogi są pomijane
+    if (!recursive && dst_type == DT_DIR) d = NULL;
+    if (d != NULL && s == NULL && strncmp(name, TMP_PREFIX, strlen(TMP_PREFIX)) == 0) // pozostałość po przerwanym kopiowaniu
+    {
+        if (ctx->plan == NULL || !ctx->plan->dry_run) unlinkat(dst_fd, name, 0);
+        return;
+    }
+    if (d != NULL && s == NULL && strncmp(name, PART_PREFIX, strlen(PART_PREFIX)) == 0) // przerwana kopia z punktem kontrolnym zostaje, dopóki jest co wznawiać
+    {
+        bool keep = ctx->opts->resume_threshold > 0 && partial_source_exists(src_fd, dst_fd, name);
+        if (!keep && (ctx->plan == NULL || !ctx->plan->dry_run)) unlinkat(dst_fd, name, 0);
+        return;
+    }
+    if (d != NULL && is_reserved_name(name)) d = NULL;
+
+    if (d != NULL && dst_type != DT_REG && dst_type != DT_DIR) // innego typu nie usuwamy
+    {
+        if (src_type == DT_DIR) log_printf(LOG_LEVEL_ERROR, "Other type named like the source directory exists at the destination\n");
+        else if (src_type == DT_REG) log_printf(LOG_LEVEL_ERROR, "Other type named like the source file exists at the destination\n");
+        if (s != NULL) job_fail(job);
+        return;
+    }
+
+    if (d != NULL && (s == NULL || src_type != dst_type)) // element docelowy bez odpowiednika tego samego typu w źródle
+    {
+        if (!have_dst_st && stat_at(dst_fd, name, &dst_st, AT_SYMLINK_NOFOLLOW) != 0) dst_st.st_mtime = 0;
+        log_entry(dst_type == DT_DIR ? 'D' : 'F', dst_ent_path, dst_st.st_mtime, "");
+        if (s == NULL) log_printf(LOG_LEVEL_DEBUG, dst_type == DT_DIR ? "Source directory doesn't exist\n" : "Source file doesn't exist\n");
+        else log_printf(LOG_LEVEL_WARNING, dst_type == DT_DIR ? "Other type named like the destination directory exists at the source\n" : "Other type named like the destination file exists at the source\n");
+        if (!remove_destination(job, dst_fd, name, dst_type, dst_ent_path)) return;
+        d = NULL;
+    }
+
+    if (src_type == DT_DIR) // element źródłowy jest katalogiem
+    {
+        if (d != NULL)
+        {
+            log_printf(LOG_LEVEL_DEBUG, "Destination directory exists\n");
+            if (rescan_now(job, src_ent_path)) spawn(job, TASK_SYNC, src_ent_path, dst_ent_path, NULL, true);
+            else log_printf(LOG_LEVEL_DEBUG, "Directory not due for a rescan (%s)\n", src_ent_path);
+        }
+        else
+        {
+            log_printf(LOG_LEVEL_DEBUG, "Destination directory doesn't exist\n");
+            spawn(job, TASK_COPY_DIRECTORY, src_ent_path, dst_ent_path, NULL, true);
+        }
+    }
+    else if (src_type == DT_REG) // element źródłowy jest zwykłym plikiem
+    {
+        if (!have_src_st && stat_at(src_fd, name, &src_st, 0) != 0)
+        {
+            perror(src_ent_path);
+            job_fail(job);
+            return;
+        }
+        off_t src_size = src_st.st_size;
+        off_t size_threshold = ctx->opts->size_threshold;
+        char suffix[80];
+        snprintf(suffix, sizeof(suffix), " size: %llu (%s)", (unsigned long long)src_size, (src_size <= size_threshold ? "doesn't exceed threshold" : "exceeds threshold"));
+        log_entry('F', src_ent_path, src_st.st_mtime, suffix);
+        if (link_later(ctx, src_ent_path, dst_ent_path, &src_st)) // kolejna nazwa już kopiowanego i-węzła
+        {
+            log_printf(LOG_LEVEL_DEBUG, "File is a hard link to an earlier file\n");
+            return;
+        }
+        if (d == NULL)
+        {
+            log_printf(LOG_LEVEL_DEBUG, "File doesn't exist at the destination\n");
+            spawn(job, TASK_COPY_FILE, src_ent_path, dst_ent_path, &src_st, true);
+            return;
+        }
+        if (dst_trusted && file_unchanged(ctx, src_ent_path, &src_st)) // indeks potwierdza, że plik jest aktualny
+        {
+            log_printf(LOG_LEVEL_DEBUG, "File unchanged since last synchronization\n");
+            return;
+        }
+        if (!have_dst_st && stat_at(dst_fd, name, &dst_st, 0) != 0)
+        {
+            perror(dst_ent_path);
+            job_fail(job);
+            return;
+        }
+        if (ctx->opts->verify) // wykrywa zmiany w tej samej sekundzie i pomija pliki, którym zmieniono tylko czas modyfikacji
+        {
+            bool same = same_content(ctx, src_ent_path, &src_st, dst_ent_path, &dst_st);
+            log_printf(LOG_LEVEL_DEBUG, same ? "File exists at the destination (same content)\n" : "File exists at the destination (different content)\n");
+            if (!same) spawn(job, TASK_COPY_FILE, src_ent_path, dst_ent_path, &src_st, true);
+            return;
+        }
+        bool same = (dst_st.st_mtime == src_st.st_mtime);
+        log_printf(LOG_LEVEL_DEBUG, same ? "File exists at the destination (same modification time)\n" : "File exists at the destination (different modification time)\n");
+        if (same) record_file(ctx, src_ent_path, &src_st, 0, 0);
+        else spawn(job, TASK_COPY_FILE, src_ent_path, dst_ent_path, &src_st, true);
+    }
+}
+
+static int open_directory(const char *path, dir_job *parent)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        log_printf(LOG_LEVEL_ERROR, "Failed opening directory (%s)\n", path);
+        job_fail(parent);
+    }
+    return fd;
+}
+
+void copy_directory(const sync_context *ctx, dir_job *parent, const char *src, const char *dst)
+{
+    stats_set_current(src);
+    int src_fd = open_directory(src, parent);
+    if (src_fd == -1) return;
+    struct stat src_dir_st;
+    // utwórz katalog docelowy z uprawnieniami źródła, w trybie planu dopiero przed kopiowaniem
+    if (stat_fd(src_fd, &src_dir_st) != 0 || (ctx->plan != NULL ? plan_add(ctx, ACT_MKDIR, src, dst, &src_dir_st, true) : mkdir(dst, src_dir_st.st_mode & 07777)) != 0)
+    {
+        log_printf(LOG_LEVEL_ERROR, "Couldn't create a directory at the destination\n");
+        close(src_fd);
+        job_fail(parent);
+        return;
+    }
+    if (ctx->plan == NULL) log_printf(LOG_LEVEL_DEBUG, "Directory created\n");
+
+    // katalog docelowy istnieje, więc jego elementy mogą być tworzone równolegle
+    dir_job *job = job_start(ctx, parent, src, dst);
+    if (job != NULL)
+    {
+        job->src_st = src_dir_st;
+        atomic_store(&job->changed, true); // nowy katalog
+    }
+    entry_list list = { 0 };
+    if (job == NULL || read_entries(src_fd, &list) != 0)
+    {
+        free_entries(&list);
+        close(src_fd);
+        job_fail(job != NULL ? job : parent);
+        job_release(job);
+        return;
+    }
+    size_t i;
+    for (i = 0; i < list.count; i++) // przeglądaj elementy w katalogu źródłowym
+    {
+        const entry *e = &list.items[i];
+        if (excluded(ctx, src_fd, src, e->name, e->type)) continue;
+        stats_count(STAT_ENTRIES, 1);
+        char src_ent_path[PATH_MAX], dst_ent_path[PATH_MAX];
+        snprintf(src_ent_path, sizeof(src_ent_path), "%s/%s", src, e->name); // ścieżka elementu źródłowego
+        snprintf(dst_ent_path, sizeof(dst_ent_path), "%s/%s", dst, e->name); // ścieżka elementu docelowego
+
+        struct stat st;
+        bool have_st = false;
+        unsigned char type = resolve_type(src_fd, e->name, e->type, &st, &have_st);
+        if (type == DT_DIR) // element źródłowy jest katalogiem
+        {
+            spawn(job, TASK_COPY_DIRECTORY, src_ent_path, dst_ent_path, NULL, true);
+        }
+        else if (type == DT_REG) // element źródłowy jest zwykłym plikiem
+        {
+            if (!have_st && stat_at(src_fd, e->name, &st, 0) != 0)
+            {
+                perror(src_ent_path);
+                job_fail(job);
+                continue;
+            }
+            if (link_later(ctx, src_ent_path, dst_ent_path, &st)) continue;
+            spawn(job, TASK_COPY_FILE, src_ent_path, dst_ent_path, &st, true);
+        }
+    }
+    free_entries(&list);
+    close(src_fd);
+    if (ctx->pool != NULL) flush_uring(); // wątek puli wysyła wsad po każdym katalogu
+    job_release(job);
+}
+
+void sync_directory(const sync_context *ctx, dir_job *parent, const char *src, const char *dst, bool recursive) // jedno przejście po obu katalogach
+{
+    stats_set_current(src);
+    int src_fd = open_directory(src, parent);
+    if (src_fd == -1) return;
+    int dst_fd = open_directory(dst, parent);
+    if (dst_fd == -1)
+    {
+        close(src_fd);
+        return;
+    }
+    struct stat src_dir_st, dst_dir_st;
+    if (stat_fd(src_fd, &src_dir_st) != 0 || stat_fd(dst_fd, &dst_dir_st) != 0)
+    {
+        close(src_fd);
+        close(dst_fd);
+        job_fail(parent);
+        return;
+    }
+    if (parent != NULL) log_entry('D', src, src_dir_st.st_mtime, "");
+
+    dir_job *job = job_start(ctx, parent, src, dst);
+    if (job == NULL)
+    {
+        close(src_fd);
+        close(dst_fd);
+        job_fail(parent);
+        return;
+    }
+    job->record = (recursive == ctx->opts->recursive);
+    job->src_st = src_dir_st;
+
+    const char *rel = rel_path(src, ctx->src_len);
+    bool dst_trusted;
+    entry_list src_list = { 0 }, dst_list = { 0 };
+    if (directory_unchanged(ctx, rel, &src_dir_st, &dst_dir_st, &dst_trusted)) // żadna ze stron nie zmieniła listy plików, weź ją z indeksu
+    {
+        read_index_entries(ctx, rel, &src_list);
+        read_index_entries(ctx, rel, &dst_list);
+    }
+    else if (read_entries(src_fd, &src_list) != 0 || read_entries(dst_fd, &dst_list) != 0)
+    {
+        log_printf(LOG_LEVEL_ERROR, "Failed reading directory (%s)\n", src);
+        job_fail(job);
+        src_list.count = dst_list.count = 0;
+    }
+
+    size_t i = 0, j = 0;
+    while (i < src_list.count || j < dst_list.count) // scalanie dwóch posortowanych list
+    {
+        int c;
+        if (i >= src_list.count) c = 1;
+        else if (j >= dst_list.count) c = -1;
+        else c = strcmp(src_list.items[i].name, dst_list.items[j].name);
+
+        if (c < 0) sync_entry(job, src_fd, dst_fd, &src_list.items[i++], NULL, recursive, dst_trusted);
+        else if (c > 0) sync_entry(job, src_fd, dst_fd, NULL, &dst_list.items[j++], recursive, dst_trusted);
+        else sync_entry(job, src_fd, dst_fd, &src_list.items[i++], &dst_list.items[j++], recursive, dst_trusted);
+    }
+    free_entries(&src_list);
+    free_entries(&dst_list);
+    close(src_fd);
+    close(dst_fd);
+    if (ctx->pool != NULL) flush_uring(); // wątek puli wysyła wsad po każdym katalogu
+    job_release(job);
+}
+
+static dev_t root_device(const char *dst)
+{
+    struct stat st;
+    return (stat(dst, &st) == 0 ? st.st_dev : 0);
+}
+
+static int compare_actions(const void *a, const void *b)
+{
+    const action *x = a, *y = b;
+    if (x->kind != y->kind) return (x->kind < y->kind ? -1 : 1);
+    if (x->kind == ACT_COPY) // kolejność fizyczna w obrębie urządzenia źródłowego
+    {
+        if (x->st.st_dev != y->st.st_dev) return (x->st.st_dev < y->st.st_dev ? -1 : 1);
+        // położenia na dysku i numery i-węzłów są nieporównywalne: najpierw pliki z położeniem, potem pozostałe
+        // według numeru i-węzła, który jest przybliżeniem kolejności przydziału
+        if (x->mapped != y->mapped) return (x->mapped ? -1 : 1);
+        if (x->mapped && x->offset != y->offset) return (x->offset < y->offset ? -1 : 1);
+        if (!x->mapped && x->st.st_ino != y->st.st_ino) return (x->st.st_ino < y->st.st_ino ? -1 : 1);
+    }
+    return strcmp(x->dst, y->dst); // katalog nadrzędny przed swoimi podkatalogami
+}
+
+static void forget_parent(const sync_context *ctx, const char *dst) // nieudane działanie: katalog musi zostać ponownie porównany
+{
+    char parent[PATH_MAX];
+    const char *slash = strrchr(dst, '/');
+    snprintf(parent, sizeof(parent), "%.*s", (slash != NULL ? (int)(slash - dst) : 0), dst);
+    forget(ctx, parent, false);
+}
+
+static void execute_action(const sync_context *ctx, const action *a)
+{
+    int res = 0;
+    switch (a->kind)
+    {
+        case ACT_REMOVE:
+            res = (a->is_dir ? discard_directory(ctx, a->dst) : unlink(a->dst));
+            if (res == 0)
+            {
+                log_printf(LOG_LEVEL_DEBUG, "Removed (%s)\n", a->dst);
+                if (!a->is_dir) stats_count(STAT_REMOVED, 1);
+            }
+            else log_printf(LOG_LEVEL_ERROR, "Failed removing (%s)\n", a->dst);
+            forget(ctx, a->dst, res == 0);
+            break;
+        case ACT_MKDIR:
+            res = mkdir(a->dst, a->st.st_mode & 07777);
+            if (res == 0) log_printf(LOG_LEVEL_DEBUG, "Directory created (%s)\n", a->dst);
+            else log_printf(LOG_LEVEL_ERROR, "Couldn't create a directory at the destination (%s)\n", a->dst);
+            break;
+        case ACT_COPY:
+        {
+            uint64_t hash;
+            res = copy_file(ctx, a->src, a->dst, &a->st, &hash);
+            if (res == 0) record_copy(ctx, a->src, a->dst, &a->st, hash);
+            break;
+        }
+        case ACT_MTIME:
+            set_directory_mtime(a->dst, &a->st);
+            return;
+        case ACT_RECORD:
+            if (!atomic_load(&ctx->plan->failed)) record_directory(ctx, a->src, &a->st, a->dst);
+            return;
+    }
+    if (res != 0)
+    {
+        stats_count(STAT_ERRORS, 1);
+        atomic_store(&ctx->plan->failed, true);
+        forget_parent(ctx, a->dst);
+    }
+}
+
+typedef struct plan_range // kolejne kopie wykonywane przez jeden wątek
+{
+    const sync_context *ctx;
+    const action *items;
+    size_t count;
+} plan_range;
+
+static void run_range(void *arg)
+{
+    plan_range *r = arg;
+    fsync_files = r->ctx->opts->fsync;
+    size_t i;
+    for (i = 0; i < r->count; i++) execute_action(r->ctx, &r->items[i]);
+    free(r);
+}
+
+static void report_plan(const sync_plan *p) // tryb -D: wypisz działania bez ich wykonywania
+{
+    size_t i;
+    for (i = 0; i < p->count; i++)
+    {
+        const action *a = &p->items[i];
+        if (a->kind == ACT_REMOVE) log_printf(LOG_LEVEL_INFO, "Would remove %s%s\n", a->is_dir ? "directory " : "", a->dst);
+        else if (a->kind == ACT_MKDIR) log_printf(LOG_LEVEL_INFO, "Would create directory %s\n", a->dst);
+        else if (a->kind == ACT_COPY) log_printf(LOG_LEVEL_INFO, "Would copy %s -> %s (%lld bytes)\n", a->src, a->dst, (long long)a->st.st_size);
+    }
+}
+
+static void plan_finish(sync_context *ctx) // wykonaj lub wypisz zaplanowane działania
+{
+    sync_plan *p = ctx->plan;
+    size_t i, counts[ACT_RECORD + 1] = { 0 };
+    unsigned long long bytes = 0;
+    qsort(p->items, p->count, sizeof(*p->items), compare_actions);
+    for (i = 0; i < p->count; i++)
+    {
+        counts[p->items[i].kind]++;
+        if (p->items[i].kind == ACT_COPY) bytes += p->items[i].st.st_size;
+    }
+    log_printf(LOG_LEVEL_INFO, "Plan: %zu entries to remove, %zu directories to create, %zu files to copy (%llu bytes)\n", counts[ACT_REMOVE], counts[ACT_MKDIR], counts[ACT_COPY], bytes);
+
+    if (p->dry_run) report_plan(p);
+    else
+    {
+        size_t first_copy = counts[ACT_REMOVE] + counts[ACT_MKDIR], end_copy = first_copy + counts[ACT_COPY];
+        for (i = 0; i < first_copy; i++) execute_action(ctx, &p->items[i]); // usunięcia i katalogi po kolei, przed kopiami do nich
+        // kopie dzielone na ciągłe zakresy, każdy wątek czyta swój obszar dysku po kolei
+        size_t ranges = (ctx->pool != NULL ? (size_t)ctx->opts->jobs : 1), per = (counts[ACT_COPY] + ranges - 1) / ranges;
+        for (i = first_copy; i < end_copy; i += per)
+        {
+            size_t n = (end_copy - i < per ? end_copy - i : per);
+            plan_range *r = malloc(sizeof(*r));
+            if (r == NULL)
+            {
+                size_t j;
+                for (j = i; j < i + n; j++) execute_action(ctx, &p->items[j]);
+                continue;
+            }
+            r->ctx = ctx;
+            r->items = &p->items[i];
+            r->count = n;
+            if (ctx->pool != NULL) pool_submit(ctx->pool, run_range, r);
+            else run_range(r);
+        }
+        if (ctx->pool != NULL) pool_wait(ctx->pool);
+        for (i = end_copy; i < p->count; i++) execute_action(ctx, &p->items[i]); // czasy katalogów po wszystkich kopiach, potem ich stan w indeksie
+    }
+
+    for (i = 0; i < p->count; i++)
+    {
+        free(p->items[i].src);
+        free(p->items[i].dst);
+    }
+    free(p->items);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+    ctx->plan = NULL;
+}
+
+static void start_pool(sync_context *ctx)
+{
+    ctx->links = (ctx->opts->hard_links && !ctx->opts->dry_run ? links_create() : NULL);
+    ctx->plan = (ctx->opts->plan || ctx->opts->dry_run ? plan_create(ctx->opts->dry_run) : NULL);
+    ctx->pool = NULL;
+    if (ctx->opts->jobs <= 1) return;
+    ctx->pool = pool_create(ctx->opts->jobs);
+    if (ctx->pool == NULL) log_printf(LOG_LEVEL_WARNING, "Couldn't start worker threads, synchronizing sequentially\n");
+}
+
+static void finish_pool(sync_context *ctx) // poczekaj na wszystkie zlecone zadania
+{
+    flush_uring();
+    if (ctx->pool != NULL) pool_wait(ctx->pool);
+    if (ctx->plan != NULL) plan_finish(ctx); // całe drzewo przejrzane, plan kompletny
+    if (ctx->pool != NULL)
+    {
+        pool_destroy(ctx->pool);
+        ctx->pool = NULL;
+    }
+    links_finish(ctx);
+}
+
+static void sync_tree(const char *src, const char *dst, const sync_options *opts, const char *link_dest)
+{
+    // kopia migawkowa musi zawierać całe drzewo, więc nie pomija katalogów
+    sync_context ctx = { opts, strlen(src), strlen(dst), NULL, root_device(dst), NULL, link_dest, NULL, (opts->snapshots == 0 && opts->recursive ? opts->rescan : NULL) };
+    if (ctx.rescan != NULL) rescan_begin(ctx.rescan);
+    fsync_files = opts->fsync;
+    start_pool(&ctx);
+    sync_directory(&ctx, NULL, src, dst, opts->recursive);
+    finish_pool(&ctx);
+}
+
+#define SNAPSHOT_FORMAT "%Y-%m-%d_%H%M%S"
+#define SNAPSHOT_NAME_LEN 17 // RRRR-MM-DD_GGMMSS
+#define SNAPSHOT_PARTIAL ".partial" // kopia w trakcie tworzenia
+#define SNAPSHOT_LATEST "latest"
+
+static bool is_snapshot_name(const char *name, bool partial)
+{
+    size_t i;
+    for (i = 0; i < SNAPSHOT_NAME_LEN; i++)
+    {
+        char c = name[i];
+        if (i == 4 || i == 7 ? c != '-' : i == 10 ? c != '_' : (c < '0' || c > '9')) return false;
+    }
+    return strcmp(name + SNAPSHOT_NAME_LEN, partial ? SNAPSHOT_PARTIAL : "") == 0;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static size_t list_snapshots(const char *dst, char ***names) // nazwy kopii migawkowych od najstarszej, przerwane kopie są usuwane
+{
+    DIR *dir = opendir(dst);
+    size_t count = 0, cap = 0;
+    *names = NULL;
+    if (dir == NULL) return 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dst, ent->d_name);
+        if (is_snapshot_name(ent->d_name, true))
+        {
+            log_printf(LOG_LEVEL_INFO, "Removing an incomplete snapshot (%s)\n", path);
+            if (trash_move(dst, path) != 0 && remove_directory(path) != 0) log_printf(LOG_LEVEL_ERROR, "Failed removing directory (%s)\n", path);
+            continue;
+        }
+        if (!is_snapshot_name(ent->d_name, false) || get_file_type(path) != FT_DIRECTORY) continue;
+        if (count == cap)
+        {
+            char **grown = realloc(*names, (cap = (cap ? cap * 2 : 16)) * sizeof(*grown));
+            if (grown == NULL) break;
+            *names = grown;
+        }
+        if (((*names)[count] = strdup(ent->d_name)) != NULL) count++;
+    }
+    closedir(dir);
+    qsort(*names, count, sizeof(**names), compare_strings); // nazwy zawierają czas, więc kolejność nazw jest chronologiczna
+    return count;
+}
+
+static void set_latest(const char *dst, const char *name) // dowiązanie symboliczne do najnowszej kopii
+{
+    char link_path[PATH_MAX], tmp[PATH_MAX];
+    snprintf(link_path, sizeof(link_path), "%s/" SNAPSHOT_LATEST, dst);
+    tmp_name(link_path, tmp, sizeof(tmp));
+    unlink(tmp);
+    if (symlink(name, tmp) != 0 || rename(tmp, link_path) != 0)
+    {
+        unlink(tmp);
+        log_printf(LOG_LEVEL_WARNING, "Couldn't update the link to the latest snapshot\n");
+    }
+}
+
+static void run_snapshot(const char *src, const char *dst, const sync_options *opts) // nowa kopia migawkowa, niezmienione pliki dowiązane z poprzedniej
+{
+    char **names;
+    size_t count = list_snapshots(dst, &names), i;
+
+    char name[SNAPSHOT_NAME_LEN + 1], partial[PATH_MAX + sizeof(SNAPSHOT_PARTIAL)], final[PATH_MAX], prev[PATH_MAX];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(name, sizeof(name), SNAPSHOT_FORMAT, &tm);
+    snprintf(final, sizeof(final), "%s/%s", dst, name);
+    snprintf(partial, sizeof(partial), "%s" SNAPSHOT_PARTIAL, final);
+    if (count > 0) snprintf(prev, sizeof(prev), "%s/%s", dst, names[count - 1]);
+
+    struct stat src_st;
+    if (count > 0 && strcmp(names[count - 1], name) == 0) log_printf(LOG_LEVEL_WARNING, "Snapshot %s already exists\n", name);
+    else if (stat_path(src, &src_st) != 0 || mkdir(partial, src_st.st_mode & 07777) != 0)
+    {
+        log_printf(LOG_LEVEL_ERROR, "Couldn't create a snapshot directory (%s)\n", partial);
+        stats_count(STAT_ERRORS, 1);
+    }
+    else
+    {
+        log_printf(LOG_LEVEL_INFO, "Creating snapshot %s%s%s\n", name, count > 0 ? " from " : "", count > 0 ? names[count - 1] : "");
+        sync_tree(src, partial, opts, count > 0 ? prev : NULL);
+        if (rename(partial, final) == 0) // kopia jest widoczna pod właściwą nazwą dopiero po zakończeniu
+        {
+            set_latest(dst, name);
+            char **grown = realloc(names, (count + 1) * sizeof(*grown));
+            if (grown != NULL && (grown[count] = strdup(name)) != NULL) count++;
+            if (grown != NULL) names = grown;
+        }
+        else log_printf(LOG_LEVEL_ERROR, "Couldn't rename the snapshot (%s)\n", partial);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (i + opts->snapshots < count) // usuń najstarsze kopie ponad limit
+        {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", dst, names[i]);
+            if (trash_move(dst, path) == 0 || remove_directory(path) == 0) log_printf(LOG_LEVEL_INFO, "Snapshot %s removed\n", names[i]);
+            else log_printf(LOG_LEVEL_ERROR, "Failed removing directory (%s)\n", path);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+void run_filesync(const char *src, const char *dst, const sync_options *opts)
+{
+    log_printf(LOG_LEVEL_INFO, "run_filesync(\"%s\", \"%s\", %s, %zu)\n", src, dst, opts->recursive ? "true" : "false", opts->size_threshold);
+    stats_cycle_begin();
+    throttle_begin();
+    if (opts->snapshots > 0) run_snapshot(src, dst, opts);
+    else sync_tree(src, dst, opts, NULL);
+    if (opts->index != NULL && !opts->dry_run) index_commit(opts->index);
+    stats_cycle_end();
+}
+
+static void sync_one_subtree(sync_context *ctx, const char *src, const char *dst, const char *rel, bool is_recursive) // synchronizuj tylko wskazane poddrzewo
+{
+    char src_path[PATH_MAX], dst_path[PATH_MAX];
+    if (rel[0] == '\0')
+    {
+        snprintf(src_path, sizeof(src_path), "%s", src);
+        snprintf(dst_path, sizeof(dst_path), "%s", dst);
+    }
+    else
+    {
+        snprintf(src_path, sizeof(src_path), "%s/%s", src, rel);
+        snprintf(dst_path, sizeof(dst_path), "%s/%s", dst, rel);
+    }
+
+    if (filter_path_excluded(ctx->opts->filter, rel))
+    {
+        log_printf(LOG_LEVEL_DEBUG, "Excluded: %s\n", rel);
+        return;
+    }
+    log_printf(LOG_LEVEL_DEBUG, "sync_subtree(\"%s\", %s)\n", src_path, is_recursive ? "true" : "false");
+
+    file_type src_ft = get_file_type(src_path), dst_ft = get_file_type(dst_path);
+    if (src_ft == FT_DIRECTORY)
+    {
+        switch (dst_ft)
+        {
+            case FT_DIRECTORY: // katalog istnieje po obu stronach
+                sync_directory(ctx, NULL, src_path, dst_path, is_recursive);
+                break;
+            case FT_NONE: // nowy katalog w źródle
+                log_printf(LOG_LEVEL_DEBUG, "Destination directory doesn't exist\n");
+                copy_directory(ctx, NULL, src_path, dst_path);
+                break;
+            default:
+                log_printf(LOG_LEVEL_ERROR, "Other type named like the source directory exists at the destination\n");
+                break;
+        }
+    }
+    else if (src_ft == FT_NONE && dst_ft == FT_DIRECTORY) // katalog usunięty ze źródła
+    {
+        log_printf(LOG_LEVEL_DEBUG, "Source directory doesn't exist\n");
+        int res = discard_directory(ctx, dst_path);
+        if (res == 0) log_printf(LOG_LEVEL_DEBUG, "Directory removed (%s)\n", dst_path);
+        else log_printf(LOG_LEVEL_ERROR, "Failed removing directory (%s)\n", dst_path);
+        forget(ctx, dst_path, res == 0);
+    }
+}
+
+void sync_subtrees(const char *src, const char *dst, const subtree *items, size_t count, const sync_options *opts) // seria zmienionych poddrzew jako jeden cykl: wspólna pula wątków i jeden zapis indeksu
+{
+    if (count == 0) return;
+    stats_cycle_begin();
+    throttle_begin();
+
+    sync_context ctx = { opts, strlen(src), strlen(dst), NULL, root_device(dst), NULL, NULL, NULL, NULL };
+    fsync_files = opts->fsync;
+    start_pool(&ctx);
+    size_t i;
+    for (i = 0; i < count; i++) sync_one_subtree(&ctx, src, dst, items[i].rel, items[i].recursive); // poddrzewa serii są rozłączne, mogą być przetwarzane równolegle
+    finish_pool(&ctx);
+    if (opts->index != NULL) index_commit(opts->index);
+    stats_cycle_end();
 }
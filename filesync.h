@@ -12,8 +12,56 @@ typedef enum file_type
     FT_OTHER
 } file_type;
 
+typedef enum copy_method
+{
+    CM_RW,
+    CM_MMAP,
+    CM_CLONE,
+    CM_COPY_RANGE,
+    CM_SENDFILE,
+    CM_URING,
+    CM_DELTA,
+    CM_SPARSE,
+    CM_LINK
+} copy_method;
+
+typedef struct sync_index sync_index;
+typedef struct filter filter;
+typedef struct rescan_table rescan_table;
+
+typedef struct sync_options
+{
+    bool recursive;
+    off_t size_threshold;
+    bool kernel_copy; // reflink, copy_file_range lub sendfile przed zwykłym kopiowaniem
+    int jobs;         // liczba wątków przeglądających i kopiujących
+    bool io_uring;    // kopiowanie wielu plików naraz przez io_uring
+    off_t delta_threshold; // rozmiar, od którego zmienione pliki są nadpisywane tylko w różniących się blokach, 0 wyłącza
+    bool verify;      // porównywanie zawartości skrótem zamiast samego czasu modyfikacji
+    bool adaptive;    // wybór mmap lub read/write i rozmiaru bufora na podstawie pomiarów
+    bool fsync;       // utrwalanie skopiowanych plików przed podmianą
+    sync_index *index; // NULL, jeśli indeks jest wyłączony
+    bool hard_links;  // odtwarzanie twardych dowiązań zamiast osobnych kopii
+    int snapshots;    // liczba zachowywanych kopii migawkowych, 0 oznacza zwykłe odwzorowanie
+    bool plan;        // najpierw lista działań, potem wykonanie w kolejności położenia danych na dysku
+    bool dry_run;     // tylko raport planu, bez zmian w miejscu docelowym
+    off_t resume_threshold; // rozmiar, od którego kopie mają punkty kontrolne i są wznawiane po przerwaniu, 0 wyłącza
+    const filter *filter;   // reguły włączania i wykluczania (-e), NULL synchronizuje wszystko
+    rescan_table *rescan;   // adaptacyjne terminy przeglądania katalogów (-x), NULL przegląda wszystko w każdym cyklu
+} sync_options;
+
+typedef struct subtree // poddrzewo do synchronizacji względem katalogu głównego
+{
+    const char *rel;
+    bool recursive; // czy porównać całe poddrzewo, czy tylko elementy katalogu
+} subtree;
+
 bool path_contains(const char *path1, const char *path2);
 file_type get_file_type(const char *path);
-void run_filesync(const char *src, const char *dst, bool is_recursive, off_t size_threshold);
+const char *copy_method_name(copy_method method);
+int remove_entry_at(int dir_fd, const char *name, unsigned char type);
+int remove_directory(const char *path);
+void run_filesync(const char *src, const char *dst, const sync_options *opts);
+void sync_subtrees(const char *src, const char *dst, const subtree *items, size_t count, const sync_options *opts);
 
 #endif
@@ -0,0 +1,326 @@
+#include "filter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <time.h>
+
+// reguły z pliku (-e), jedna w wierszu, pierwsza pasująca rozstrzyga:
+//   [+|-|!]wzorzec[/] [size>N[kMG]] [size<N] [age>N[smhd]] [age<N]
+// "-" lub brak znaku wyklucza, "+" lub "!" włącza; wzorzec zaczynający się od "/" lub zawierający "/"
+// dotyczy ścieżki względem katalogu głównego, inaczej samej nazwy na dowolnej głębokości;
+// "/" na końcu ogranicza regułę do katalogów, "**" pasuje także do "/"
+// nazwy bez symboli wieloznacznych trafiają do tablicy haszującej, wzorce "*.ext" są porównywane
+// jako końcówki, pozostałe przez fnmatch; warunki rozmiaru i wieku wymagają stat i dotyczą tylko plików
+
+#define MAX_RULE_LINE (PATH_MAX + 64)
+
+typedef enum rule_kind
+{
+    RULE_LITERAL, // dokładna nazwa lub ścieżka, w tablicy haszującej
+    RULE_SUFFIX,  // "*" i stała końcówka
+    RULE_GLOB
+} rule_kind;
+
+typedef struct rule
+{
+    char *pattern;
+    size_t len;
+    rule_kind kind;
+    bool include;
+    bool anchored; // wzorzec dopasowywany do ścieżki, nie nazwy
+    bool dir_only;
+    bool deep;     // "**", gwiazdka przechodzi przez "/"
+    int size_op, age_op; // -1 mniejszy, 1 większy, 0 bez warunku
+    long long size, age;
+    int next;      // następna reguła dosłowna o tym samym kluczu, -1 na końcu
+} rule;
+
+struct filter
+{
+    rule *rules;
+    size_t count;
+    int *slots;    // tablica haszująca pierwszych reguł dosłownych, -1 oznacza wolne miejsce
+    size_t cap;
+    int *patterns; // indeksy reguł niedosłownych, rosnąco
+    size_t pattern_count;
+    uint64_t hash; // skrót treści reguł, zapisywany w indeksie
+};
+
+static uint64_t hash_string(const char *s) // FNV-1a
+{
+    uint64_t h = 1469598103934665603ULL;
+    while (*s != '\0')
+    {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t hash_line(uint64_t h, const char *s) // FNV-1a kontynuowany, wiersz zakończony '\n'
+{
+    while (*s != '\0')
+    {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return (h ^ '\n') * 1099511628211ULL;
+}
+
+static int find_literal(const filter *f, const char *key)
+{
+    if (f->cap == 0) return -1;
+    size_t i = hash_string(key) & (f->cap - 1);
+    while (f->slots[i] != -1 && strcmp(f->rules[f->slots[i]].pattern, key) != 0) i = (i + 1) & (f->cap - 1);
+    return f->slots[i];
+}
+
+static bool parse_predicate(rule *r, const char *s)
+{
+    bool is_size = (strncmp(s, "size", 4) == 0);
+    if (!is_size && strncmp(s, "age", 3) != 0) return false;
+    s += (is_size ? 4 : 3);
+    int op = (*s == '<' ? -1 : (*s == '>' ? 1 : 0));
+    if (op == 0) return false;
+    char *end;
+    long long value = strtoll(s + 1, &end, 10);
+    if (end == s + 1 || value < 0) return false;
+    const char *units = (is_size ? "kMG" : "smhd");
+    static const long long size_mult[] = { 1024LL, 1024LL * 1024, 1024LL * 1024 * 1024 };
+    static const long long age_mult[] = { 1, 60, 3600, 86400 };
+    if (*end != '\0')
+    {
+        const char *u = strchr(units, *end);
+        if (u == NULL || end[1] != '\0') return false;
+        value *= (is_size ? size_mult[u - units] : age_mult[u - units]);
+    }
+    if (is_size)
+    {
+        r->size_op = op;
+        r->size = value;
+    }
+    else
+    {
+        r->age_op = op;
+        r->age = value;
+    }
+    return true;
+}
+
+static bool parse_rule(rule *r, char *line)
+{
+    char *save, *tok = strtok_r(line, " \t", &save);
+    memset(r, 0, sizeof(*r));
+    if (strcmp(tok, "+") == 0 || strcmp(tok, "-") == 0) // składnia rsync: znak, odstęp, wzorzec
+    {
+        r->include = (tok[0] == '+');
+        if ((tok = strtok_r(NULL, " \t", &save)) == NULL) return false;
+    }
+    else if (tok[0] == '!') // składnia gitignore
+    {
+        r->include = true;
+        tok++;
+    }
+    size_t len = strlen(tok);
+    if (len > 1 && tok[len - 1] == '/')
+    {
+        r->dir_only = true;
+        tok[--len] = '\0';
+    }
+    if (strncmp(tok, "**/", 3) == 0 && strchr(tok + 3, '/') == NULL) tok += 3; // "**/nazwa" to nazwa na dowolnej głębokości
+    if (tok[0] == '/')
+    {
+        r->anchored = true;
+        tok++;
+    }
+    if (tok[0] == '\0') return false;
+    r->anchored = r->anchored || strchr(tok, '/') != NULL;
+    r->deep = (strstr(tok, "**") != NULL);
+    if ((r->pattern = strdup(tok)) == NULL) return false;
+    r->len = strlen(tok);
+    if (strpbrk(tok, "*?[\\") == NULL) r->kind = RULE_LITERAL;
+    else if (!r->anchored && tok[0] == '*' && strpbrk(tok + 1, "*?[\\") == NULL) r->kind = RULE_SUFFIX;
+    else r->kind = RULE_GLOB;
+
+    while ((tok = strtok_r(NULL, " \t", &save)) != NULL)
+    {
+        if (!parse_predicate(r, tok)) return false;
+    }
+    return true;
+}
+
+static bool compile(filter *f) // tablica haszująca reguł dosłownych i lista pozostałych
+{
+    size_t literals = 0, i;
+    for (i = 0; i < f->count; i++) literals += (f->rules[i].kind == RULE_LITERAL);
+    f->patterns = malloc((f->count - literals + 1) * sizeof(*f->patterns));
+    if (f->patterns == NULL) return false;
+    if (literals > 0)
+    {
+        for (f->cap = 16; f->cap < literals * 2; f->cap *= 2);
+        if ((f->slots = malloc(f->cap * sizeof(*f->slots))) == NULL) return false;
+        memset(f->slots, 0xff, f->cap * sizeof(*f->slots));
+    }
+    for (i = 0; i < f->count; i++)
+    {
+        rule *r = &f->rules[i];
+        r->next = -1;
+        if (r->kind != RULE_LITERAL)
+        {
+            f->patterns[f->pattern_count++] = (int)i;
+            continue;
+        }
+        size_t slot = hash_string(r->pattern) & (f->cap - 1);
+        while (f->slots[slot] != -1 && strcmp(f->rules[f->slots[slot]].pattern, r->pattern) != 0) slot = (slot + 1) & (f->cap - 1);
+        if (f->slots[slot] == -1) f->slots[slot] = (int)i;
+        else // dołącz na koniec łańcucha, kolejność reguł zostaje zachowana
+        {
+            int j = f->slots[slot];
+            while (f->rules[j].next != -1) j = f->rules[j].next;
+            f->rules[j].next = (int)i;
+        }
+    }
+    return true;
+}
+
+filter *filter_load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("Couldn't open the rules file (%s)!\n", path);
+        return NULL;
+    }
+    filter *f = calloc(1, sizeof(*f));
+    size_t cap = 0;
+    char line[MAX_RULE_LINE];
+    int line_no = 0;
+    bool ok = (f != NULL);
+    if (ok) f->hash = 1469598103934665603ULL;
+    while (ok && fgets(line, sizeof(line), file) != NULL)
+    {
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *start = line + strspn(line, " \t");
+        if (start[0] == '\0' || start[0] == '#') continue;
+        f->hash = hash_line(f->hash, start); // przed parse_rule, które dzieli wiersz
+        if (f->count == cap)
+        {
+            rule *grown = realloc(f->rules, (cap = (cap ? cap * 2 : 16)) * sizeof(*grown));
+            if (grown == NULL)
+            {
+                ok = false;
+                break;
+            }
+            f->rules = grown;
+        }
+        if (!parse_rule(&f->rules[f->count], start))
+        {
+            free(f->rules[f->count].pattern);
+            printf("Invalid rule at line %d of %s!\n", line_no, path);
+            ok = false;
+            break;
+        }
+        f->count++;
+    }
+    fclose(file);
+    if (ok && compile(f)) return f;
+    filter_free(f);
+    return NULL;
+}
+
+static int rule_applies(const rule *r, unsigned char type, const struct stat *st) // 1 tak, 0 nie, -1 potrzebny stat
+{
+    if (!r->dir_only && r->size_op == 0 && r->age_op == 0) return 1;
+    if (type == DT_UNKNOWN)
+    {
+        if (st == NULL) return -1;
+        type = (S_ISDIR(st->st_mode) ? DT_DIR : DT_REG);
+    }
+    if (r->dir_only) return type == DT_DIR && r->size_op == 0 && r->age_op == 0;
+    if (type == DT_DIR) return 0; // warunki rozmiaru i wieku dotyczą plików
+    if (st == NULL) return -1;
+    if (r->size_op != 0 && (r->size_op < 0 ? st->st_size >= r->size : st->st_size <= r->size)) return 0;
+    long long age = (long long)(time(NULL) - st->st_mtime);
+    if (r->age_op != 0 && (r->age_op < 0 ? age >= r->age : age <= r->age)) return 0;
+    return 1;
+}
+
+static bool pattern_matches(const rule *r, const char *rel, const char *name, size_t name_len)
+{
+    if (r->kind == RULE_SUFFIX) return name_len >= r->len - 1 && memcmp(name + name_len - (r->len - 1), r->pattern + 1, r->len - 1) == 0;
+    return fnmatch(r->pattern, (r->anchored ? rel : name), (r->deep ? 0 : FNM_PATHNAME)) == 0;
+}
+
+static int next_literal(const filter *f, int i, bool anchored) // pierwsza reguła łańcucha o danym zakotwiczeniu
+{
+    while (i != -1 && f->rules[i].anchored != anchored) i = f->rules[i].next;
+    return i;
+}
+
+uint64_t filter_hash(const filter *f) // 0 bez reguł
+{
+    return (f != NULL ? f->hash : 0);
+}
+
+filter_result filter_match(const filter *f, const char *rel, const char *name, unsigned char type, const struct stat *st) // rel to ścieżka względem katalogu głównego, name jej ostatni element
+{
+    if (f == NULL) return FILTER_INCLUDE;
+    size_t name_len = strlen(name), k = 0;
+    int by_name = next_literal(f, find_literal(f, name), false), by_path = next_literal(f, find_literal(f, rel), true);
+    while (1) // trzy rosnące ciągi kandydatów scalane w kolejności reguł w pliku
+    {
+        int i = INT_MAX;
+        if (by_name != -1 && by_name < i) i = by_name;
+        if (by_path != -1 && by_path < i) i = by_path;
+        if (k < f->pattern_count && f->patterns[k] < i) i = f->patterns[k];
+        if (i == INT_MAX) return FILTER_INCLUDE;
+
+        const rule *r = &f->rules[i];
+        bool matched = true;
+        if (i == by_name) by_name = next_literal(f, r->next, false);
+        else if (i == by_path) by_path = next_literal(f, r->next, true);
+        else
+        {
+            k++;
+            matched = pattern_matches(r, rel, name, name_len);
+        }
+        if (!matched) continue;
+        int applies = rule_applies(r, type, st);
+        if (applies < 0) return FILTER_NEED_STAT;
+        if (applies) return (r->include ? FILTER_INCLUDE : FILTER_EXCLUDE);
+    }
+}
+
+bool filter_path_excluded(const filter *f, const char *rel) // czy katalog rel lub któryś z katalogów nad nim jest wykluczony (bez stat)
+{
+    if (f == NULL || rel[0] == '\0') return false;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", rel);
+    char *slash = path;
+    while (1)
+    {
+        slash = strchr(slash, '/');
+        if (slash != NULL) *slash = '\0';
+        const char *name = strrchr(path, '/');
+        name = (name != NULL ? name + 1 : path);
+        if (filter_match(f, path, name, DT_DIR, NULL) == FILTER_EXCLUDE) return true;
+        if (slash == NULL) return false;
+        *slash++ = '/';
+    }
+}
+
+void filter_free(filter *f)
+{
+    if (f == NULL) return;
+    size_t i;
+    for (i = 0; i < f->count; i++) free(f->rules[i].pattern);
+    free(f->rules);
+    free(f->slots);
+    free(f->patterns);
+    free(f);
+}
@@ -0,0 +1,23 @@
+#ifndef FILESYNC_FILTER
+#define FILESYNC_FILTER
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+typedef enum filter_result
+{
+    FILTER_INCLUDE,
+    FILTER_EXCLUDE,
+    FILTER_NEED_STAT // rozstrzyga reguła z warunkiem rozmiaru lub wieku albo tylko dla katalogów
+} filter_result;
+
+typedef struct filter filter;
+
+filter *filter_load(const char *path);
+filter_result filter_match(const filter *f, const char *rel, const char *name, unsigned char type, const struct stat *st);
+bool filter_path_excluded(const filter *f, const char *rel);
+uint64_t filter_hash(const filter *f);
+void filter_free(filter *f);
+
+#endif
@@ -0,0 +1,167 @@
+#include "hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// skrót w stylu xxh64: cztery niezależne tory po 8 bajtów, które procesor przetwarza równolegle
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+#define HASH_FILE_BUF (256 * 1024)
+
+static uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= round64(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+static void consume(hash_state *h, const unsigned char *p, size_t stripes) // pełne 32-bajtowe paski
+{
+    uint64_t v0 = h->lanes[0], v1 = h->lanes[1], v2 = h->lanes[2], v3 = h->lanes[3];
+    size_t i;
+    for (i = 0; i < stripes; i++, p += 32)
+    {
+        v0 = round64(v0, read64(p));
+        v1 = round64(v1, read64(p + 8));
+        v2 = round64(v2, read64(p + 16));
+        v3 = round64(v3, read64(p + 24));
+    }
+    h->lanes[0] = v0;
+    h->lanes[1] = v1;
+    h->lanes[2] = v2;
+    h->lanes[3] = v3;
+}
+
+void hash_init(hash_state *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->lanes[0] = PRIME1 + PRIME2;
+    h->lanes[1] = PRIME2;
+    h->lanes[2] = 0;
+    h->lanes[3] = -PRIME1;
+}
+
+void hash_update(hash_state *h, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    h->total_len += len;
+    if (h->buf_len > 0) // dopełnij pasek zaczęty w poprzednim wywołaniu
+    {
+        size_t n = 32 - h->buf_len;
+        if (n > len) n = len;
+        memcpy(h->buf + h->buf_len, p, n);
+        h->buf_len += n;
+        p += n;
+        len -= n;
+        if (h->buf_len < 32) return;
+        consume(h, h->buf, 1);
+        h->buf_len = 0;
+    }
+    consume(h, p, len / 32);
+    p += len / 32 * 32;
+    len %= 32;
+    memcpy(h->buf, p, len);
+    h->buf_len = len;
+}
+
+uint64_t hash_final(const hash_state *h)
+{
+    uint64_t acc;
+    if (h->total_len >= 32)
+    {
+        acc = rotl(h->lanes[0], 1) + rotl(h->lanes[1], 7) + rotl(h->lanes[2], 12) + rotl(h->lanes[3], 18);
+        acc = merge_round(acc, h->lanes[0]);
+        acc = merge_round(acc, h->lanes[1]);
+        acc = merge_round(acc, h->lanes[2]);
+        acc = merge_round(acc, h->lanes[3]);
+    }
+    else acc = h->lanes[2] + PRIME5;
+    acc += h->total_len;
+
+    const unsigned char *p = h->buf, *end = h->buf + h->buf_len;
+    for (; p + 8 <= end; p += 8)
+    {
+        acc ^= round64(0, read64(p));
+        acc = rotl(acc, 27) * PRIME1 + PRIME4;
+    }
+    if (p + 4 <= end)
+    {
+        acc ^= (uint64_t)read32(p) * PRIME1;
+        acc = rotl(acc, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++)
+    {
+        acc ^= *p * PRIME5;
+        acc = rotl(acc, 11) * PRIME1;
+    }
+
+    acc ^= acc >> 33;
+    acc *= PRIME2;
+    acc ^= acc >> 29;
+    acc *= PRIME3;
+    acc ^= acc >> 32;
+    return acc;
+}
+
+int hash_file(const char *path, uint64_t *hash) // skrót całej zawartości pliku
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    char *buf = malloc(HASH_FILE_BUF);
+    if (buf == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    hash_state h;
+    hash_init(&h);
+    ssize_t n;
+    while ((n = read(fd, buf, HASH_FILE_BUF)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+        hash_update(&h, buf, n);
+    }
+    free(buf);
+    close(fd);
+    if (n < 0) return -1;
+    *hash = hash_final(&h);
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef FILESYNC_HASH
+#define FILESYNC_HASH
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct hash_state // stan skrótu liczonego przyrostowo w trakcie kopiowania
+{
+    uint64_t lanes[4];
+    uint64_t total_len;
+    unsigned char buf[32];
+    size_t buf_len;
+} hash_state;
+
+void hash_init(hash_state *h);
+void hash_update(hash_state *h, const void *data, size_t len);
+uint64_t hash_final(const hash_state *h);
+int hash_file(const char *path, uint64_t *hash);
+
+#endif
@@ -0,0 +1,451 @@
+#include "index.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#define INDEX_MAGIC "FSYNCIDX"
+#define INDEX_VERSION 3
+
+typedef struct index_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    uint64_t strings_size;
+    uint64_t checksum;
+    uint64_t rules_hash; // skrót reguł (-e), z którymi zbudowano indeks
+} index_header;
+
+typedef struct disk_record
+{
+    uint64_t path_off;
+    uint32_t path_len;
+    uint32_t type;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    int64_t dst_mtime_ns;
+    uint64_t hash;
+    uint64_t dst_ino;
+} disk_record;
+
+typedef struct change
+{
+    index_record rec; // rec.path należy do zmiany (strdup)
+    size_t seq;
+} change;
+
+typedef struct path_list
+{
+    char **paths;
+    size_t count, cap;
+} path_list;
+
+struct sync_index
+{
+    char path[PATH_MAX];
+    uint64_t rules_hash;
+    pthread_mutex_t lock; // zmiany mogą być dopisywane z wielu wątków
+    void *map;
+    size_t map_size;
+    const disk_record *records;
+    const char *strings;
+    size_t count;
+    change *puts;
+    size_t put_count, put_cap;
+    path_list removed;     // usunięte poddrzewa
+    path_list invalidated; // wpisy, których nie wolno zapisać w tym cyklu
+};
+
+static uint64_t checksum(const void *data, size_t len, uint64_t h) // FNV-1a
+{
+    const unsigned char *p = data;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void to_record(const sync_index *idx, const disk_record *d, index_record *rec)
+{
+    rec->path = idx->strings + d->path_off;
+    rec->type = d->type;
+    rec->ino = d->ino;
+    rec->size = d->size;
+    rec->mtime_ns = d->mtime_ns;
+    rec->ctime_ns = d->ctime_ns;
+    rec->dst_mtime_ns = d->dst_mtime_ns;
+    rec->hash = d->hash;
+    rec->dst_ino = d->dst_ino;
+}
+
+static bool within(const char *parent, const char *path) // czy path leży w poddrzewie parent (lub jest nim)
+{
+    size_t len = strlen(parent);
+    if (len == 0) return true;
+    return strncmp(parent, path, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+static void unmap(sync_index *idx)
+{
+    if (idx->map != NULL) munmap(idx->map, idx->map_size);
+    idx->map = NULL;
+    idx->map_size = 0;
+    idx->records = NULL;
+    idx->strings = NULL;
+    idx->count = 0;
+}
+
+static int load(sync_index *idx) // zmapuj plik indeksu i sprawdź jego spójność
+{
+    int fd = open(idx->path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(index_header))
+    {
+        close(fd);
+        return -2;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -2;
+
+    const index_header *h = map;
+    const disk_record *records = (const disk_record *)(h + 1);
+    size_t expected = sizeof(*h) + h->count * sizeof(disk_record) + h->strings_size;
+    if (memcmp(h->magic, INDEX_MAGIC, 8) != 0 || h->version != INDEX_VERSION || h->record_size != sizeof(disk_record)
+        || h->count > (size_t)st.st_size / sizeof(disk_record) || h->strings_size > (size_t)st.st_size || expected != (size_t)st.st_size
+        || checksum(records, st.st_size - sizeof(*h), 14695981039346656037ULL) != h->checksum)
+    {
+        munmap(map, st.st_size);
+        return -2;
+    }
+    if (h->rules_hash != idx->rules_hash) // zapisane listy katalogów pomijają elementy wykluczone starymi regułami
+    {
+        munmap(map, st.st_size);
+        return -3;
+    }
+    const char *strings = (const char *)(records + h->count);
+    size_t i;
+    for (i = 0; i < h->count; i++) // ścieżki muszą mieścić się w pliku i kończyć zerem
+    {
+        if (records[i].path_off + records[i].path_len >= h->strings_size || strings[records[i].path_off + records[i].path_len] != '\0')
+        {
+            munmap(map, st.st_size);
+            return -2;
+        }
+    }
+    madvise(map, st.st_size, MADV_WILLNEED);
+    idx->map = map;
+    idx->map_size = st.st_size;
+    idx->records = records;
+    idx->strings = strings;
+    idx->count = h->count;
+    return 0;
+}
+
+sync_index *index_open(const char *dst, uint64_t rules_hash)
+{
+    sync_index *idx = calloc(1, sizeof(*idx));
+    if (idx == NULL) return NULL;
+    idx->rules_hash = rules_hash;
+    pthread_mutex_init(&idx->lock, NULL);
+    // plik indeksu jest w osobnym podkatalogu, by jego zapis nie zmieniał czasu modyfikacji katalogu docelowego
+    snprintf(idx->path, sizeof(idx->path), "%s/%s", dst, STATE_DIR_NAME);
+    mkdir(idx->path, 0755);
+    snprintf(idx->path, sizeof(idx->path), "%s/%s/%s", dst, STATE_DIR_NAME, INDEX_FILE_NAME);
+    char str[PATH_MAX + 60];
+    switch (load(idx))
+    {
+        case 0:
+            snprintf(str, sizeof(str), "Index loaded (%zu entries)\n", idx->count);
+            break;
+        case -1:
+            snprintf(str, sizeof(str), "Index doesn't exist, it will be built during synchronization\n");
+            break;
+        case -3:
+            snprintf(str, sizeof(str), "Filter rules changed, the index will be rebuilt\n");
+            break;
+        default:
+            snprintf(str, sizeof(str), "Index is corrupt, it will be rebuilt (%s)\n", idx->path);
+            break;
+    }
+    writeToLog(str);
+    return idx;
+}
+
+static size_t lower_bound(const sync_index *idx, const char *path)
+{
+    size_t lo = 0, hi = idx->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(idx->strings + idx->records[mid].path_off, path) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+bool index_find(const sync_index *idx, const char *rel, index_record *rec)
+{
+    size_t i = lower_bound(idx, rel);
+    if (i >= idx->count || strcmp(idx->strings + idx->records[i].path_off, rel) != 0) return false;
+    to_record(idx, &idx->records[i], rec);
+    return true;
+}
+
+size_t index_children(const sync_index *idx, const char *rel, index_record **children) // bezpośrednie dzieci katalogu
+{
+    char prefix[PATH_MAX];
+    size_t len = 0;
+    if (rel[0] != '\0') len = snprintf(prefix, sizeof(prefix), "%s/", rel);
+    else prefix[0] = '\0';
+
+    size_t i = lower_bound(idx, prefix), n = 0, cap = 0;
+    *children = NULL;
+    for (; i < idx->count; i++)
+    {
+        const char *p = idx->strings + idx->records[i].path_off;
+        if (strncmp(p, prefix, len) != 0) break;
+        if (p[len] == '\0' || strchr(p + len, '/') != NULL) continue;
+        if (n == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            index_record *c = realloc(*children, cap * sizeof(*c));
+            if (c == NULL) break;
+            *children = c;
+        }
+        to_record(idx, &idx->records[i], &(*children)[n++]);
+    }
+    return n;
+}
+
+static void list_add(path_list *l, const char *path)
+{
+    if (l->count == l->cap)
+    {
+        size_t cap = l->cap ? l->cap * 2 : 16;
+        char **p = realloc(l->paths, cap * sizeof(*p));
+        if (p == NULL) return;
+        l->paths = p;
+        l->cap = cap;
+    }
+    l->paths[l->count++] = strdup(path);
+}
+
+static void list_clear(path_list *l)
+{
+    size_t i;
+    for (i = 0; i < l->count; i++) free(l->paths[i]);
+    l->count = 0;
+}
+
+static bool list_covers(const path_list *l, const char *path) // czy ścieżka leży w którymś z poddrzew listy
+{
+    size_t i;
+    for (i = 0; i < l->count; i++)
+    {
+        if (within(l->paths[i], path)) return true;
+    }
+    return false;
+}
+
+void index_put(sync_index *idx, const index_record *rec)
+{
+    pthread_mutex_lock(&idx->lock);
+    if (idx->put_count == idx->put_cap)
+    {
+        size_t cap = idx->put_cap ? idx->put_cap * 2 : 256;
+        change *c = realloc(idx->puts, cap * sizeof(*c));
+        if (c == NULL)
+        {
+            pthread_mutex_unlock(&idx->lock);
+            return;
+        }
+        idx->puts = c;
+        idx->put_cap = cap;
+    }
+    change *c = &idx->puts[idx->put_count];
+    c->rec = *rec;
+    c->rec.path = strdup(rec->path);
+    c->seq = idx->put_count++;
+    pthread_mutex_unlock(&idx->lock);
+}
+
+void index_remove(sync_index *idx, const char *rel)
+{
+    pthread_mutex_lock(&idx->lock);
+    list_add(&idx->removed, rel);
+    pthread_mutex_unlock(&idx->lock);
+}
+
+void index_invalidate(sync_index *idx, const char *rel)
+{
+    pthread_mutex_lock(&idx->lock);
+    list_add(&idx->invalidated, rel);
+    pthread_mutex_unlock(&idx->lock);
+}
+
+static int compare_changes(const void *a, const void *b)
+{
+    const change *x = a, *y = b;
+    int c = strcmp(x->rec.path, y->rec.path);
+    if (c != 0) return c;
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static bool is_invalidated(const sync_index *idx, const char *path) // unieważnienie obejmuje też wszystkie katalogi nadrzędne
+{
+    size_t i;
+    for (i = 0; i < idx->invalidated.count; i++)
+    {
+        if (within(path, idx->invalidated.paths[i])) return true;
+    }
+    return false;
+}
+
+static int write_record(FILE *f, const index_record *rec, uint64_t *strings_size, uint64_t *sum)
+{
+    disk_record d;
+    memset(&d, 0, sizeof(d));
+    d.path_off = *strings_size;
+    d.path_len = strlen(rec->path);
+    d.type = rec->type;
+    d.ino = rec->ino;
+    d.size = rec->size;
+    d.mtime_ns = rec->mtime_ns;
+    d.ctime_ns = rec->ctime_ns;
+    d.dst_mtime_ns = rec->dst_mtime_ns;
+    d.hash = rec->hash;
+    d.dst_ino = rec->dst_ino;
+    *strings_size += d.path_len + 1;
+    *sum = checksum(&d, sizeof(d), *sum);
+    return fwrite(&d, sizeof(d), 1, f) == 1 ? 0 : -1;
+}
+
+static void reset_changes(sync_index *idx)
+{
+    size_t i;
+    for (i = 0; i < idx->put_count; i++) free((char *)idx->puts[i].rec.path);
+    idx->put_count = 0;
+    list_clear(&idx->removed);
+    list_clear(&idx->invalidated);
+}
+
+int index_commit(sync_index *idx) // scal zmiany z cyklu z poprzednim stanem i zapisz indeks atomowo
+{
+    if (idx->put_count == 0 && idx->removed.count == 0 && idx->invalidated.count == 0) return 0;
+
+    qsort(idx->puts, idx->put_count, sizeof(change), compare_changes);
+    size_t i, n = 0;
+    for (i = 0; i < idx->put_count; i++) // zostaw tylko ostatnią zmianę dla każdej ścieżki
+    {
+        if (n > 0 && strcmp(idx->puts[n - 1].rec.path, idx->puts[i].rec.path) == 0)
+        {
+            free((char *)idx->puts[n - 1].rec.path);
+            idx->puts[n - 1] = idx->puts[i];
+        }
+        else idx->puts[n++] = idx->puts[i];
+    }
+    idx->put_count = n;
+
+    // scalanie dwóch posortowanych ciągów: stary indeks i nowe wpisy
+    index_record *merged = malloc((idx->count + idx->put_count + 1) * sizeof(*merged));
+    if (merged == NULL)
+    {
+        reset_changes(idx);
+        return -1;
+    }
+    size_t a = 0, b = 0, m = 0;
+    while (a < idx->count || b < idx->put_count)
+    {
+        index_record old;
+        int c;
+        if (a < idx->count) to_record(idx, &idx->records[a], &old);
+        if (a >= idx->count) c = 1;
+        else if (b >= idx->put_count) c = -1;
+        else c = strcmp(old.path, idx->puts[b].rec.path);
+
+        if (c < 0)
+        {
+            a++;
+            if (list_covers(&idx->removed, old.path)) continue;
+            merged[m] = old;
+        }
+        else
+        {
+            if (c == 0) a++;
+            merged[m] = idx->puts[b++].rec;
+        }
+        if (!is_invalidated(idx, merged[m].path)) m++;
+    }
+
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", idx->path);
+    // tylko dla właściciela: demon działa z umask 0, a zmieniony indeks kazałby pomijać katalogi
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (fd != -1) fchmod(fd, 0600); // pozostałość po przerwanym zapisie mogła mieć inne uprawnienia
+    FILE *f = (fd != -1 ? fdopen(fd, "w") : NULL);
+    if (f == NULL && fd != -1) close(fd);
+    int res = -1;
+    if (f != NULL)
+    {
+        index_header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, INDEX_MAGIC, 8);
+        h.version = INDEX_VERSION;
+        h.record_size = sizeof(disk_record);
+        h.count = m;
+        h.rules_hash = idx->rules_hash;
+        uint64_t sum = 14695981039346656037ULL;
+        res = fwrite(&h, sizeof(h), 1, f) == 1 ? 0 : -1;
+        for (i = 0; i < m && res == 0; i++) res = write_record(f, &merged[i], &h.strings_size, &sum);
+        for (i = 0; i < m && res == 0; i++)
+        {
+            size_t len = strlen(merged[i].path) + 1;
+            sum = checksum(merged[i].path, len, sum);
+            if (fwrite(merged[i].path, len, 1, f) != 1) res = -1;
+        }
+        h.checksum = sum;
+        if (res == 0 && (fseek(f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, f) != 1)) res = -1;
+        if (fflush(f) != 0 || fsync(fileno(f)) != 0) res = -1;
+        if (fclose(f) != 0) res = -1;
+    }
+    free(merged);
+
+    // ścieżki w merged wskazują na stare mapowanie i zmiany, więc zwolnij je dopiero po zapisie
+    reset_changes(idx);
+    unmap(idx);
+    if (res == 0 && rename(tmp, idx->path) != 0) res = -1;
+    if (res != 0)
+    {
+        unlink(tmp);
+        log_write(LOG_LEVEL_ERROR, "Failed to write the index\n");
+    }
+    if (load(idx) != 0) unmap(idx);
+    return res;
+}
+
+void index_close(sync_index *idx)
+{
+    if (idx == NULL) return;
+    reset_changes(idx);
+    free(idx->puts);
+    free(idx->removed.paths);
+    free(idx->invalidated.paths);
+    unmap(idx);
+    pthread_mutex_destroy(&idx->lock);
+    free(idx);
+}
@@ -0,0 +1,35 @@
+#ifndef FILESYNC_INDEX
+#define FILESYNC_INDEX
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATE_DIR_NAME ".filesyncd.state" // katalog stanu demona w katalogu docelowym
+#define INDEX_FILE_NAME "index"
+
+typedef struct index_record
+{
+    const char *path; // ścieżka względem katalogu głównego
+    uint32_t type;    // file_type
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    int64_t dst_mtime_ns; // czas modyfikacji katalogu docelowego (tylko katalogi)
+    uint64_t hash;        // skrót zawartości pliku, 0 jeśli nieznany
+    uint64_t dst_ino;     // i-węzeł pliku docelowego, którego dotyczy skrót
+} index_record;
+
+typedef struct sync_index sync_index;
+
+sync_index *index_open(const char *dst, uint64_t rules_hash);
+bool index_find(const sync_index *idx, const char *rel, index_record *rec);
+size_t index_children(const sync_index *idx, const char *rel, index_record **children);
+void index_put(sync_index *idx, const index_record *rec);
+void index_remove(sync_index *idx, const char *rel);
+void index_invalidate(sync_index *idx, const char *rel);
+int index_commit(sync_index *idx);
+void index_close(sync_index *idx);
+
+#endif
@@ -0,0 +1,230 @@
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <syslog.h>
+#include <time.h>
+#include <pthread.h>
+
+#define LOG_SLOTS 512 // potęga dwójki
+#define LOG_MSG_SIZE (PATH_MAX + 256)
+#define LOG_BATCH_SIZE (64 * 1024)
+#define LOG_FLUSH_INTERVAL_MS 50
+#define LOG_BLOCK_MS 200 // najdłuższe oczekiwanie na miejsce w kolejce dla ostrzeżeń i komunikatów informacyjnych
+
+typedef struct log_slot
+{
+    atomic_size_t seq; // numer zapisu, dla którego slot jest wolny lub gotowy do odczytu
+    log_level level;
+    char text[LOG_MSG_SIZE];
+} log_slot;
+
+bool uselog = false;
+log_level log_threshold = LOG_LEVEL_INFO;
+
+// kolejka ograniczona bez blokad: wiele wątków zapisuje, jeden wątek opróżnia
+static log_slot *ring = NULL;
+static atomic_size_t enqueue_pos, dequeue_pos;
+static atomic_size_t dropped;
+static atomic_bool running = false, stopping = false;
+static pthread_t flusher;
+
+void openLogFile()
+{
+    openlog("filesyncd", LOG_PID, LOG_DAEMON);
+    uselog = true;
+}
+
+void closeLogFile()
+{
+    closelog();
+    uselog = false;
+}
+
+static int priority(log_level level)
+{
+    switch (level)
+    {
+        case LOG_LEVEL_ERROR: return LOG_ERR;
+        case LOG_LEVEL_WARNING: return LOG_WARNING;
+        case LOG_LEVEL_INFO: return LOG_NOTICE;
+        case LOG_LEVEL_DEBUG: return LOG_DEBUG;
+    }
+    return LOG_NOTICE;
+}
+
+static void emit(log_level level, const char *str) // zapis bez pośrednictwa kolejki
+{
+    if (uselog) syslog(priority(level), "%s", str);
+    else fputs(str, stdout);
+}
+
+static bool push(log_level level, const char *str)
+{
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    while (1)
+    {
+        log_slot *slot = &ring[pos & (LOG_SLOTS - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                slot->level = level;
+                snprintf(slot->text, sizeof(slot->text), "%s", str);
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) return false; // kolejka pełna
+        else pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    }
+}
+
+static log_slot *peek(void)
+{
+    size_t pos = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+    log_slot *slot = &ring[pos & (LOG_SLOTS - 1)];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1) return NULL;
+    return slot;
+}
+
+static void release_slot(log_slot *slot)
+{
+    size_t pos = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, pos + LOG_SLOTS, memory_order_release);
+    atomic_store_explicit(&dequeue_pos, pos + 1, memory_order_relaxed);
+}
+
+static size_t drain(char *batch) // wypisz wszystkie oczekujące komunikaty
+{
+    size_t count = 0, batch_len = 0;
+    log_slot *slot;
+    while ((slot = peek()) != NULL)
+    {
+        if (uselog) syslog(priority(slot->level), "%s", slot->text);
+        else // na standardowe wyjście komunikaty trafiają jednym zapisem
+        {
+            size_t len = strlen(slot->text);
+            if (batch_len + len > LOG_BATCH_SIZE)
+            {
+                fwrite(batch, 1, batch_len, stdout);
+                batch_len = 0;
+            }
+            memcpy(batch + batch_len, slot->text, len);
+            batch_len += len;
+        }
+        release_slot(slot);
+        count++;
+    }
+    if (batch_len > 0)
+    {
+        fwrite(batch, 1, batch_len, stdout);
+        fflush(stdout);
+    }
+    size_t lost = atomic_exchange(&dropped, 0);
+    if (lost > 0)
+    {
+        char str[80];
+        snprintf(str, sizeof(str), "%zu debug messages dropped, log queue was full\n", lost);
+        emit(LOG_LEVEL_WARNING, str);
+    }
+    return count;
+}
+
+static void *flush_thread(void *arg)
+{
+    char *batch = arg;
+    struct timespec ts = { 0, LOG_FLUSH_INTERVAL_MS * 1000000L };
+    while (1)
+    {
+        if (drain(batch) > 0) continue;
+        if (atomic_load(&stopping)) break;
+        nanosleep(&ts, NULL);
+    }
+    free(batch);
+    return NULL;
+}
+
+void log_start(void) // uruchom wątek zapisujący, wywoływane po utworzeniu procesu demona
+{
+    if (atomic_load(&running)) return;
+    if (ring == NULL) ring = calloc(LOG_SLOTS, sizeof(log_slot)); // kolejka zostaje po zatrzymaniu, mogą do niej trafić spóźnione komunikaty
+    char *batch = malloc(LOG_BATCH_SIZE);
+    if (ring == NULL || batch == NULL)
+    {
+        free(ring);
+        free(batch);
+        ring = NULL;
+        return;
+    }
+    size_t i;
+    for (i = 0; i < LOG_SLOTS; i++) atomic_init(&ring[i].seq, i);
+    atomic_store(&enqueue_pos, 0);
+    atomic_store(&dequeue_pos, 0);
+    atomic_store(&stopping, false);
+    if (pthread_create(&flusher, NULL, flush_thread, batch) != 0)
+    {
+        free(batch);
+        return;
+    }
+    atomic_store(&running, true);
+}
+
+void log_stop(void) // wypisz zaległe komunikaty i zatrzymaj wątek
+{
+    if (!atomic_load(&running)) return;
+    atomic_store(&running, false);
+    atomic_store(&stopping, true);
+    pthread_join(flusher, NULL);
+    char *tail = malloc(LOG_BATCH_SIZE);
+    if (tail != NULL) drain(tail); // komunikaty dopisane w trakcie zatrzymywania
+    free(tail);
+}
+
+void log_write(log_level level, const char *str)
+{
+    if (!log_enabled(level)) return;
+    if (!atomic_load(&running))
+    {
+        emit(level, str);
+        return;
+    }
+    if (push(level, str)) return;
+    if (level == LOG_LEVEL_DEBUG) // odrzucane są tylko komunikaty dla pojedynczych plików
+    {
+        atomic_fetch_add(&dropped, 1);
+        return;
+    }
+    if (level != LOG_LEVEL_ERROR) // ostrzeżenie lub komunikat informacyjny czeka chwilę na opróżnienie kolejki
+    {
+        struct timespec ts = { 0, 1000000L };
+        int waited;
+        for (waited = 0; waited < LOG_BLOCK_MS; waited++)
+        {
+            nanosleep(&ts, NULL);
+            if (push(level, str)) return;
+        }
+    }
+    emit(level, str); // błędy i komunikaty, które nie zmieściły się w czasie, zapisywane od razu
+}
+
+void log_format(log_level level, const char *fmt, ...)
+{
+    char str[LOG_MSG_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(str, sizeof(str), fmt, args);
+    va_end(args);
+    log_write(level, str);
+}
+
+void writeToLog(const char *str)
+{
+    log_write(LOG_LEVEL_INFO, str);
+}
@@ -0,0 +1,32 @@
+#ifndef FILESYNC_LOG
+#define FILESYNC_LOG
+
+#include <stdbool.h>
+
+typedef enum log_level
+{
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,   // podsumowania cykli i zdarzenia demona
+    LOG_LEVEL_DEBUG   // komunikaty dla każdego pliku
+} log_level;
+
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_LEVEL_DEBUG // -DLOG_MAX_LEVEL=LOG_LEVEL_INFO usuwa komunikaty plików podczas kompilacji
+#endif
+
+extern log_level log_threshold;
+
+// sprawdzane w miejscu wywołania, więc odfiltrowany komunikat nie jest nawet formatowany
+#define log_enabled(level) ((level) <= LOG_MAX_LEVEL && (level) <= log_threshold)
+#define log_printf(level, ...) do { if (log_enabled(level)) log_format(level, __VA_ARGS__); } while (0)
+
+void openLogFile();
+void closeLogFile();
+void log_start(void);
+void log_stop(void);
+void log_write(log_level level, const char *str);
+void log_format(log_level level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void writeToLog(const char *str);
+
+#endif
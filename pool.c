@@ -0,0 +1,239 @@
+#include "pool.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+typedef struct task
+{
+    task_fn fn;
+    void *arg;
+} task;
+
+typedef struct deque // kolejka wątku: właściciel korzysta z końca, pozostałe wątki kradną z początku
+{
+    pthread_mutex_t lock;
+    task *items;
+    size_t head, tail, cap;
+} deque;
+
+struct thread_pool
+{
+    int count, queue_count;
+    pthread_t *threads;
+    deque *queues;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond, done_cond;
+    atomic_size_t queued;  // zadania oczekujące w kolejkach
+    atomic_size_t pending; // zadania zlecone i jeszcze niezakończone
+    atomic_uint next;      // kolejka dla zadań zlecanych spoza puli
+    bool stop;
+};
+
+typedef struct worker_arg
+{
+    thread_pool *pool;
+    int index;
+} worker_arg;
+
+static __thread thread_pool *current_pool = NULL;
+static __thread int current_index = -1;
+
+static bool push(deque *q, task t)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->tail == q->cap)
+    {
+        if (q->head > 0) // przesuń zawartość na początek bufora
+        {
+            size_t i;
+            for (i = q->head; i < q->tail; i++) q->items[i - q->head] = q->items[i];
+            q->tail -= q->head;
+            q->head = 0;
+        }
+        if (q->tail == q->cap)
+        {
+            size_t cap = q->cap ? q->cap * 2 : 64;
+            task *items = realloc(q->items, cap * sizeof(*items));
+            if (items == NULL)
+            {
+                pthread_mutex_unlock(&q->lock);
+                return false;
+            }
+            q->items = items;
+            q->cap = cap;
+        }
+    }
+    q->items[q->tail++] = t;
+    pthread_mutex_unlock(&q->lock);
+    return true;
+}
+
+static bool pop_bottom(deque *q, task *t) // najnowsze zadanie, przejście w głąb drzewa
+{
+    bool res = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head)
+    {
+        *t = q->items[--q->tail];
+        res = true;
+    }
+    if (q->head == q->tail) q->head = q->tail = 0;
+    pthread_mutex_unlock(&q->lock);
+    return res;
+}
+
+static bool steal_top(deque *q, task *t, bool wait) // najstarsze zadanie, zwykle największe poddrzewo
+{
+    bool res = false;
+    if (wait) pthread_mutex_lock(&q->lock);
+    else if (pthread_mutex_trylock(&q->lock) != 0) return false;
+    if (q->tail > q->head)
+    {
+        *t = q->items[q->head++];
+        res = true;
+    }
+    if (q->head == q->tail) q->head = q->tail = 0;
+    pthread_mutex_unlock(&q->lock);
+    return res;
+}
+
+static bool take(thread_pool *pool, int index, task *t, bool wait) // wait: czekaj na zajęte kolejki innych wątków zamiast je pomijać
+{
+    if (pop_bottom(&pool->queues[index], t)) return true;
+    int i;
+    for (i = 1; i < pool->count; i++)
+    {
+        if (steal_top(&pool->queues[(index + i) % pool->count], t, wait)) return true;
+    }
+    return false;
+}
+
+static void finish(thread_pool *pool)
+{
+    if (atomic_fetch_sub(&pool->pending, 1) == 1)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void *worker(void *arg)
+{
+    worker_arg *wa = arg;
+    thread_pool *pool = wa->pool;
+    int index = wa->index;
+    free(wa);
+    current_pool = pool;
+    current_index = index;
+
+    while (1)
+    {
+        task t;
+        if (atomic_load(&pool->queued) > 0)
+        {
+            if (take(pool, index, &t, false) || take(pool, index, &t, true))
+            {
+                atomic_fetch_sub(&pool->queued, 1);
+                t.fn(t.arg);
+                finish(pool);
+                continue;
+            }
+            sched_yield(); // licznik obejmuje jeszcze zadanie właśnie zabrane lub dopiero wstawiane, nie kręć się na blokadach
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && atomic_load(&pool->queued) == 0) pthread_cond_wait(&pool->work_cond, &pool->lock);
+        bool stop = pool->stop && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) break;
+    }
+    return NULL;
+}
+
+thread_pool *pool_create(int threads)
+{
+    thread_pool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) return NULL;
+    pool->threads = calloc(threads, sizeof(pthread_t));
+    pool->queues = calloc(threads, sizeof(deque));
+    if (pool->threads == NULL || pool->queues == NULL)
+    {
+        free(pool->threads);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    int i;
+    for (i = 0; i < threads; i++) pthread_mutex_init(&pool->queues[i].lock, NULL);
+    pool->queue_count = threads;
+    for (i = 0; i < threads; i++)
+    {
+        worker_arg *wa = malloc(sizeof(*wa));
+        if (wa == NULL) break;
+        wa->pool = pool;
+        wa->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker, wa) != 0)
+        {
+            free(wa);
+            break;
+        }
+        pool->count++;
+    }
+    if (pool->count == 0)
+    {
+        pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void pool_submit(thread_pool *pool, task_fn fn, void *arg)
+{
+    task t = { fn, arg };
+    int index = (current_pool == pool ? current_index : (int)(atomic_fetch_add(&pool->next, 1) % pool->count));
+    atomic_fetch_add(&pool->pending, 1);
+    if (!push(&pool->queues[index], t)) // brak pamięci, wykonaj zadanie od razu
+    {
+        fn(arg);
+        finish(pool);
+        return;
+    }
+    atomic_fetch_add(&pool->queued, 1);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(thread_pool *pool) // czekaj aż wszystkie zadania, również zlecone przez inne zadania, się zakończą
+{
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->pending) > 0) pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_destroy(thread_pool *pool)
+{
+    if (pool == NULL) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    int i;
+    for (i = 0; i < pool->count; i++) pthread_join(pool->threads[i], NULL);
+    for (i = 0; i < pool->queue_count; i++)
+    {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+        free(pool->queues[i].items);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_cond_destroy(&pool->done_cond);
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+}
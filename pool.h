@@ -0,0 +1,13 @@
+#ifndef FILESYNC_POOL
+#define FILESYNC_POOL
+
+typedef void (*task_fn)(void *arg);
+
+typedef struct thread_pool thread_pool;
+
+thread_pool *pool_create(int threads);
+void pool_submit(thread_pool *pool, task_fn fn, void *arg);
+void pool_wait(thread_pool *pool);
+void pool_destroy(thread_pool *pool);
+
+#endif
@@ -0,0 +1,146 @@
+#include "rescan.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// adaptacyjne przeglądanie katalogów (-x) dla systemów plików bez powiadomień o zmianach (NFS, FUSE):
+// katalog, w którym coś się zmieniło, jest przeglądany w każdym cyklu, a niezmieniony coraz rzadziej
+// (odstęp podwajany od długości cyklu do max_staleness); katalog nadrzędny jest przeglądany,
+// gdy przypada termin jego własny lub któregoś katalogu pod nim
+
+typedef struct dir_state
+{
+    char *path;          // ścieżka względem katalogu głównego, NULL oznacza wolne miejsce
+    int64_t mtime_ns;    // czas modyfikacji katalogu źródłowego przy ostatnim przeglądzie
+    int interval;        // sekundy do następnego przeglądu, 0 w każdym cyklu
+    time_t subtree_due;  // najbliższy termin katalogu lub któregoś katalogu pod nim
+} dir_state;
+
+struct rescan_table
+{
+    pthread_mutex_t lock; // katalogi przeglądane są przez wiele wątków
+    dir_state *dirs;
+    size_t count, cap;
+    int max_staleness;
+    time_t last_begin;
+    int cycle;           // zmierzony odstęp między cyklami
+    atomic_bool forced;  // żądanie synchronizacji, następny cykl przegląda wszystko
+    bool full;           // bieżący cykl przegląda wszystko
+};
+
+static uint64_t hash_path(const char *s) // FNV-1a
+{
+    uint64_t h = 1469598103934665603ULL;
+    while (*s != '\0')
+    {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static dir_state *find_slot(dir_state *dirs, size_t cap, const char *path)
+{
+    size_t i = hash_path(path) & (cap - 1);
+    while (dirs[i].path != NULL && strcmp(dirs[i].path, path) != 0) i = (i + 1) & (cap - 1);
+    return &dirs[i];
+}
+
+static bool grow(rescan_table *t)
+{
+    size_t cap = t->cap * 2, i;
+    dir_state *dirs = calloc(cap, sizeof(*dirs));
+    if (dirs == NULL) return false;
+    for (i = 0; i < t->cap; i++)
+    {
+        if (t->dirs[i].path != NULL) *find_slot(dirs, cap, t->dirs[i].path) = t->dirs[i];
+    }
+    free(t->dirs);
+    t->dirs = dirs;
+    t->cap = cap;
+    return true;
+}
+
+rescan_table *rescan_create(int max_staleness)
+{
+    rescan_table *t = calloc(1, sizeof(*t));
+    if (t == NULL) return NULL;
+    t->cap = 1024;
+    if ((t->dirs = calloc(t->cap, sizeof(*t->dirs))) == NULL)
+    {
+        free(t);
+        return NULL;
+    }
+    pthread_mutex_init(&t->lock, NULL);
+    t->max_staleness = max_staleness;
+    t->cycle = 1;
+    return t;
+}
+
+void rescan_begin(rescan_table *t) // na początku cyklu
+{
+    time_t now = time(NULL);
+    pthread_mutex_lock(&t->lock);
+    if (t->last_begin != 0 && now > t->last_begin) t->cycle = (int)(now - t->last_begin);
+    t->last_begin = now;
+    t->full = atomic_exchange(&t->forced, false);
+    pthread_mutex_unlock(&t->lock);
+}
+
+bool rescan_due(rescan_table *t, const char *rel, time_t *subtree_due) // czy przejrzeć katalog w tym cyklu; jeśli nie, zwraca jego termin
+{
+    time_t now = time(NULL);
+    pthread_mutex_lock(&t->lock);
+    const dir_state *d = find_slot(t->dirs, t->cap, rel);
+    // połowa cyklu tolerancji, żeby niewielkie opóźnienie cyklu nie przesuwało przeglądu o cały następny
+    bool due = t->full || d->path == NULL || d->subtree_due <= now + t->cycle / 2;
+    if (!due) *subtree_due = d->subtree_due;
+    pthread_mutex_unlock(&t->lock);
+    return due;
+}
+
+time_t rescan_done(rescan_table *t, const char *rel, int64_t mtime_ns, bool changed, time_t children_due) // zapisz wynik przeglądu, zwraca termin poddrzewa
+{
+    time_t now = time(NULL), due;
+    pthread_mutex_lock(&t->lock);
+    if ((t->count + 1) * 2 > t->cap) grow(t);
+    dir_state *d = find_slot(t->dirs, t->cap, rel);
+    if (d->path == NULL) // nowy katalog, przeglądany w następnym cyklu
+    {
+        if ((d->path = strdup(rel)) == NULL)
+        {
+            pthread_mutex_unlock(&t->lock);
+            return now;
+        }
+        t->count++;
+        changed = true;
+    }
+    if (changed || d->mtime_ns != mtime_ns) d->interval = 0;
+    else
+    {
+        d->interval = (d->interval == 0 ? t->cycle : d->interval * 2);
+        if (d->interval > t->max_staleness) d->interval = t->max_staleness;
+    }
+    d->mtime_ns = mtime_ns;
+    due = now + d->interval;
+    d->subtree_due = (children_due < due ? children_due : due);
+    due = d->subtree_due;
+    pthread_mutex_unlock(&t->lock);
+    return due;
+}
+
+void rescan_force(rescan_table *t) // żądanie synchronizacji: przejrzyj wszystko w następnym cyklu
+{
+    if (t != NULL) atomic_store(&t->forced, true);
+}
+
+void rescan_free(rescan_table *t)
+{
+    if (t == NULL) return;
+    size_t i;
+    for (i = 0; i < t->cap; i++) free(t->dirs[i].path);
+    free(t->dirs);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
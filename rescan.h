@@ -0,0 +1,17 @@
+#ifndef FILESYNC_RESCAN
+#define FILESYNC_RESCAN
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct rescan_table rescan_table;
+
+rescan_table *rescan_create(int max_staleness);
+void rescan_begin(rescan_table *t);
+bool rescan_due(rescan_table *t, const char *rel, time_t *subtree_due);
+time_t rescan_done(rescan_table *t, const char *rel, int64_t mtime_ns, bool changed, time_t children_due);
+void rescan_force(rescan_table *t);
+void rescan_free(rescan_table *t);
+
+#endif
@@ -0,0 +1,170 @@
+#include "schedule.h"
+#include "log.h"
+#include "control.h"
+#include "rescan.h"
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+static int free_jobs; // wątki wspólnej puli niezajęte przez trwające synchronizacje
+
+static double elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void *run_pair(void *arg)
+{
+    sync_pair *p = arg;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_filesync(p->src, p->dst, &p->opts);
+    log_printf(LOG_LEVEL_INFO, "Pair %s -> %s synchronized in %.3f s, next run in %d s\n", p->src, p->dst, elapsed(&start), p->interval);
+
+    pthread_mutex_lock(&lock);
+    p->running = false;
+    p->runs++;
+    p->next_run = time(NULL) + (p->requested ? 0 : p->interval);
+    p->requested = false;
+    free_jobs += p->opts.jobs;
+    pthread_cond_signal(&finished);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static bool shares_device(const sync_pair *a, const sync_pair *b)
+{
+    return a->src_dev == b->src_dev || a->src_dev == b->dst_dev || a->dst_dev == b->src_dev || a->dst_dev == b->dst_dev;
+}
+
+static bool device_busy(const sync_pair *pairs, size_t count, const sync_pair *p) // nie skanuj dwa razy naraz tego samego urządzenia
+{
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        if (pairs[i].running && shares_device(&pairs[i], p)) return true;
+    }
+    return false;
+}
+
+static sync_pair *next_due(sync_pair *pairs, size_t count, time_t now, bool once, time_t *wake) // najdłużej oczekująca para gotowa do uruchomienia
+{
+    sync_pair *best = NULL;
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        sync_pair *p = &pairs[i];
+        if (p->running || (once && p->runs > 0)) continue;
+        if (p->next_run > now)
+        {
+            if (p->next_run < *wake) *wake = p->next_run;
+            continue;
+        }
+        if (device_busy(pairs, count, p)) continue;
+        if (best == NULL || p->next_run < best->next_run) best = p;
+    }
+    return best;
+}
+
+static void wake_scheduler(void)
+{
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&finished);
+    pthread_mutex_unlock(&lock);
+}
+
+static void request_pair(sync_pair *p, time_t now)
+{
+    rescan_force(p->opts.rescan);
+    if (p->running) p->requested = true;
+    else p->next_run = now;
+}
+
+static void take_requests(sync_pair *pairs, size_t count, time_t now) // żądania z gniazda sterującego: cała para, do której należy ścieżka
+{
+    sync_request req;
+    if (!control_take(&req)) return;
+    size_t i, j;
+    for (i = 0; i < count; i++)
+    {
+        bool match = req.full;
+        for (j = 0; !match && j < req.count; j++) match = (strcmp(req.paths[j], pairs[i].src) == 0 || path_contains(pairs[i].src, req.paths[j]));
+        if (match) request_pair(&pairs[i], now);
+    }
+    for (j = 0; j < req.count; j++)
+    {
+        if (req.paths[j][0] != '/') log_printf(LOG_LEVEL_WARNING, "Requests need an absolute path with a configuration file (%s)\n", req.paths[j]);
+    }
+    control_release(&req);
+}
+
+static bool start_pair(sync_pair *p)
+{
+    pthread_t thread;
+    p->running = true;
+    free_jobs -= p->opts.jobs;
+    if (pthread_create(&thread, NULL, run_pair, p) == 0)
+    {
+        pthread_detach(thread);
+        return true;
+    }
+    p->running = false;
+    free_jobs += p->opts.jobs;
+    return false;
+}
+
+void run_schedule(sync_pair *pairs, size_t count, int budget, bool once) // uruchamiaj pary w wyznaczonych odstępach, dzieląc wątki między nie
+{
+    time_t now = time(NULL);
+    size_t i;
+    for (i = 0; i < count; i++)
+    {
+        sync_pair *p = &pairs[i];
+        struct stat st;
+        p->src_dev = (stat(p->src, &st) == 0 ? st.st_dev : 0);
+        p->dst_dev = (stat(p->dst, &st) == 0 ? st.st_dev : 0);
+        if (p->opts.jobs > budget) p->opts.jobs = budget; // para nie może zająć więcej niż cała pula
+        p->next_run = now;
+        p->runs = 0;
+        p->running = false;
+        p->requested = false;
+    }
+    control_set_notify(wake_scheduler);
+    log_printf(LOG_LEVEL_INFO, "Scheduling %zu pairs on %d threads\n", count, budget);
+
+    pthread_mutex_lock(&lock);
+    free_jobs = budget;
+    while (1)
+    {
+        now = time(NULL);
+        take_requests(pairs, count, now);
+        time_t wake = now + 3600;
+        sync_pair *p;
+        while ((p = next_due(pairs, count, now, once, &wake)) != NULL)
+        {
+            if (p->opts.jobs > free_jobs) break; // zarezerwuj wątki dla najdłużej oczekującej pary
+            if (!start_pair(p))
+            {
+                log_printf(LOG_LEVEL_ERROR, "Couldn't start synchronization of %s\n", p->src);
+                p->runs++;
+                p->next_run = now + p->interval;
+            }
+        }
+
+        bool active = false;
+        for (i = 0; i < count; i++)
+        {
+            if (pairs[i].running || (!once || pairs[i].runs == 0)) active = true;
+        }
+        if (!active) break; // tryb jednorazowy, wszystkie pary zsynchronizowane
+
+        struct timespec ts = { wake, 0 };
+        pthread_cond_timedwait(&finished, &lock, &ts);
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,26 @@
+#ifndef FILESYNC_SCHEDULE
+#define FILESYNC_SCHEDULE
+
+#include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include "filesync.h"
+
+typedef struct sync_pair // para katalogów z pliku konfiguracyjnego
+{
+    char src[PATH_MAX], dst[PATH_MAX];
+    sync_options opts;
+    int interval; // sekundy między synchronizacjami
+    bool use_index;
+    // stan harmonogramu
+    dev_t src_dev, dst_dev;
+    time_t next_run;
+    unsigned runs;
+    bool running;
+    bool requested; // żądanie synchronizacji w trakcie trwającej, powtórz zaraz po niej
+} sync_pair;
+
+void run_schedule(sync_pair *pairs, size_t count, int budget, bool once);
+
+#endif
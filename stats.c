@@ -0,0 +1,225 @@
+#include "stats.h"
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef struct sync_stats
+{
+    atomic_uint_fast64_t counters[STAT_COUNTERS];
+    atomic_uint_fast64_t files[COPY_METHODS];
+    atomic_uint_fast64_t bytes[COPY_METHODS];
+    atomic_uint_fast64_t latency[LATENCY_BUCKETS];
+    atomic_uint_fast64_t cycles;
+    atomic_uint_fast64_t duration_ns;
+} sync_stats;
+
+static const char *counter_names[STAT_COUNTERS] = { "entries_scanned", "stat_calls", "removed", "errors" };
+
+static sync_stats cycle, total; // bieżący (lub ostatni) cykl i suma od uruchomienia
+static struct timespec cycle_start;
+static int cycle_active = 0; // synchronizacje trwające równocześnie (-c), liczone jako jeden cykl
+static pthread_mutex_t cycle_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t previous_entries = 0; // elementy przejrzane w poprzednim cyklu, podstawa oszacowania postępu
+static char current_path[PATH_MAX] = "";
+static pthread_mutex_t current_lock = PTHREAD_MUTEX_INITIALIZER;
+static char stats_path[PATH_MAX] = "";
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec - start->tv_nsec;
+}
+
+static void add(atomic_uint_fast64_t *cycle_value, atomic_uint_fast64_t *total_value, uint64_t n)
+{
+    atomic_fetch_add_explicit(cycle_value, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(total_value, n, memory_order_relaxed);
+}
+
+void stats_count(stat_counter counter, uint64_t n)
+{
+    add(&cycle.counters[counter], &total.counters[counter], n);
+}
+
+void stats_copied(copy_method method, uint64_t bytes, const struct timespec *start) // zlicz skopiowany plik i czas kopiowania
+{
+    uint64_t us = elapsed_ns(start) / 1000;
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && us >= (1ULL << bucket)) bucket++;
+    add(&cycle.files[method], &total.files[method], 1);
+    add(&cycle.bytes[method], &total.bytes[method], bytes);
+    add(&cycle.latency[bucket], &total.latency[bucket], 1);
+}
+
+void stats_cycle_begin(void)
+{
+    pthread_mutex_lock(&cycle_lock);
+    if (cycle_active++ > 0) // cykl już trwa, dolicz się do niego
+    {
+        pthread_mutex_unlock(&cycle_lock);
+        return;
+    }
+    int i;
+    for (i = 0; i < STAT_COUNTERS; i++) atomic_store(&cycle.counters[i], 0);
+    for (i = 0; i < COPY_METHODS; i++)
+    {
+        atomic_store(&cycle.files[i], 0);
+        atomic_store(&cycle.bytes[i], 0);
+    }
+    for (i = 0; i < LATENCY_BUCKETS; i++) atomic_store(&cycle.latency[i], 0);
+    clock_gettime(CLOCK_MONOTONIC, &cycle_start);
+    pthread_mutex_unlock(&cycle_lock);
+}
+
+static uint64_t sum(atomic_uint_fast64_t *values, int count)
+{
+    uint64_t res = 0;
+    int i;
+    for (i = 0; i < count; i++) res += atomic_load(&values[i]);
+    return res;
+}
+
+static void write_stats(FILE *f, const char *name, sync_stats *s)
+{
+    int i;
+    fprintf(f, "  \"%s\": {\n", name);
+    fprintf(f, "    \"cycles\": %llu,\n", (unsigned long long)atomic_load(&s->cycles));
+    fprintf(f, "    \"duration_s\": %.6f,\n", atomic_load(&s->duration_ns) / 1e9);
+    for (i = 0; i < STAT_COUNTERS; i++) fprintf(f, "    \"%s\": %llu,\n", counter_names[i], (unsigned long long)atomic_load(&s->counters[i]));
+    fprintf(f, "    \"copied\": {");
+    for (i = 0; i < COPY_METHODS; i++)
+    {
+        fprintf(f, "%s\n      \"%s\": { \"files\": %llu, \"bytes\": %llu }", (i > 0 ? "," : ""), copy_method_name(i),
+                (unsigned long long)atomic_load(&s->files[i]), (unsigned long long)atomic_load(&s->bytes[i]));
+    }
+    fprintf(f, "\n    },\n");
+    fprintf(f, "    \"copy_latency_us\": {"); // liczba kopii o czasie mniejszym niż klucz
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        if (i < LATENCY_BUCKETS - 1) fprintf(f, "%s \"%llu\": %llu", (i > 0 ? "," : ""), 1ULL << i, (unsigned long long)atomic_load(&s->latency[i]));
+        else fprintf(f, ", \"inf\": %llu", (unsigned long long)atomic_load(&s->latency[i]));
+    }
+    fprintf(f, " }\n  }");
+}
+
+static void write_file(void) // zapis atomowy przez plik tymczasowy
+{
+    pthread_mutex_lock(&write_lock);
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600); // demon działa z umask 0
+    if (fd != -1) fchmod(fd, 0600);
+    FILE *f = (fd != -1 ? fdopen(fd, "w") : NULL);
+    if (f == NULL && fd != -1) close(fd);
+    if (f == NULL)
+    {
+        pthread_mutex_unlock(&write_lock);
+        log_printf(LOG_LEVEL_ERROR, "Failed to write statistics (%s)\n", stats_path);
+        return;
+    }
+    fprintf(f, "{\n  \"timestamp\": %lld,\n", (long long)time(NULL));
+    write_stats(f, "last_cycle", &cycle);
+    fprintf(f, ",\n");
+    write_stats(f, "total", &total);
+    fprintf(f, "\n}\n");
+    if (fclose(f) != 0 || rename(tmp, stats_path) != 0) // czytelnik zawsze widzi kompletny plik
+    {
+        unlink(tmp);
+        log_printf(LOG_LEVEL_ERROR, "Failed to write statistics (%s)\n", stats_path);
+    }
+    pthread_mutex_unlock(&write_lock);
+}
+
+void stats_cycle_end(void) // podsumowanie cyklu w dzienniku i w pliku statystyk
+{
+    pthread_mutex_lock(&cycle_lock);
+    if (--cycle_active > 0)
+    {
+        pthread_mutex_unlock(&cycle_lock);
+        return;
+    }
+    uint64_t ns = elapsed_ns(&cycle_start);
+    atomic_store(&cycle.duration_ns, ns);
+    atomic_store(&cycle.cycles, 1);
+    atomic_fetch_add(&total.duration_ns, ns);
+    atomic_fetch_add(&total.cycles, 1);
+    previous_entries = atomic_load(&cycle.counters[STAT_ENTRIES]);
+    log_printf(LOG_LEVEL_INFO, "Synchronization finished in %.3f s: %llu entries scanned, %llu files copied (%llu bytes), %llu removed, %llu errors\n",
+               ns / 1e9, (unsigned long long)atomic_load(&cycle.counters[STAT_ENTRIES]), (unsigned long long)sum(cycle.files, COPY_METHODS),
+               (unsigned long long)sum(cycle.bytes, COPY_METHODS), (unsigned long long)atomic_load(&cycle.counters[STAT_REMOVED]),
+               (unsigned long long)atomic_load(&cycle.counters[STAT_ERRORS]));
+    pthread_mutex_unlock(&cycle_lock);
+    if (stats_path[0] != '\0') write_file();
+}
+
+void stats_set_current(const char *path) // przeglądany katalog, pokazywany w stanie demona
+{
+    if (pthread_mutex_trylock(&current_lock) != 0) return; // inny wątek właśnie go ustawia, wystarczy jedna z wartości
+    snprintf(current_path, sizeof(current_path), "%s", path);
+    pthread_mutex_unlock(&current_lock);
+}
+
+void stats_status(char *buf, size_t size) // stan demona dla gniazda sterującego
+{
+    pthread_mutex_lock(&cycle_lock);
+    if (cycle_active == 0)
+    {
+        snprintf(buf, size, "idle, %llu cycles, last cycle %.3f s, %llu entries scanned, %llu files copied\n",
+                 (unsigned long long)atomic_load(&total.cycles), atomic_load(&cycle.duration_ns) / 1e9,
+                 (unsigned long long)atomic_load(&cycle.counters[STAT_ENTRIES]), (unsigned long long)sum(cycle.files, COPY_METHODS));
+        pthread_mutex_unlock(&cycle_lock);
+        return;
+    }
+    double elapsed = elapsed_ns(&cycle_start) / 1e9;
+    uint64_t entries = atomic_load(&cycle.counters[STAT_ENTRIES]), expected = previous_entries;
+    pthread_mutex_unlock(&cycle_lock);
+    char path[PATH_MAX];
+    pthread_mutex_lock(&current_lock);
+    snprintf(path, sizeof(path), "%s", current_path);
+    pthread_mutex_unlock(&current_lock);
+    if (expected == 0 || entries >= expected) // pierwszy cykl lub drzewo urosło, postępu nie da się oszacować
+    {
+        snprintf(buf, size, "running for %.1f s, %llu entries scanned, current: %s\n", elapsed, (unsigned long long)entries, path);
+        return;
+    }
+    double done = (double)entries / expected;
+    snprintf(buf, size, "running for %.1f s, %.0f%% (%llu of ~%llu entries), ETA %.1f s, current: %s\n",
+             elapsed, done * 100, (unsigned long long)entries, (unsigned long long)expected, (entries > 0 ? elapsed * (1 - done) / done : 0), path);
+}
+
+void stats_set_file(const char *path)
+{
+    snprintf(stats_path, sizeof(stats_path), "%s", path);
+}
+
+void stats_dump(void) // statystyki od uruchomienia w dzienniku i w pliku statystyk
+{
+    log_printf(LOG_LEVEL_INFO, "Statistics: %llu cycles, %.3f s, %llu entries scanned, %llu stat calls, %llu files copied (%llu bytes), %llu removed, %llu errors\n",
+               (unsigned long long)atomic_load(&total.cycles), atomic_load(&total.duration_ns) / 1e9,
+               (unsigned long long)atomic_load(&total.counters[STAT_ENTRIES]), (unsigned long long)atomic_load(&total.counters[STAT_STATS]),
+               (unsigned long long)sum(total.files, COPY_METHODS), (unsigned long long)sum(total.bytes, COPY_METHODS),
+               (unsigned long long)atomic_load(&total.counters[STAT_REMOVED]), (unsigned long long)atomic_load(&total.counters[STAT_ERRORS]));
+    int i;
+    for (i = 0; i < COPY_METHODS; i++)
+    {
+        uint64_t files = atomic_load(&total.files[i]);
+        if (files > 0) log_printf(LOG_LEVEL_INFO, "Copied with %s: %llu files, %llu bytes\n", copy_method_name(i), (unsigned long long)files, (unsigned long long)atomic_load(&total.bytes[i]));
+    }
+    if (stats_path[0] != '\0') write_file();
+}
+
+void stats_cycle_totals(uint64_t counters[STAT_COUNTERS], uint64_t *files, uint64_t *bytes) // liczniki ostatniego cyklu
+{
+    int i;
+    for (i = 0; i < STAT_COUNTERS; i++) counters[i] = atomic_load(&cycle.counters[i]);
+    *files = sum(cycle.files, COPY_METHODS);
+    *bytes = sum(cycle.bytes, COPY_METHODS);
+}
@@ -0,0 +1,30 @@
+#ifndef FILESYNC_STATS
+#define FILESYNC_STATS
+
+#include <stdint.h>
+#include <time.h>
+#include "filesync.h"
+
+typedef enum stat_counter
+{
+    STAT_ENTRIES,  // przejrzane elementy katalogów
+    STAT_STATS,    // wywołania stat/fstat/fstatat
+    STAT_REMOVED,  // usunięte pliki i katalogi
+    STAT_ERRORS,
+    STAT_COUNTERS
+} stat_counter;
+
+#define COPY_METHODS (CM_LINK + 1)
+#define LATENCY_BUCKETS 24 // przedziały potęg dwójki w mikrosekundach, ostatni bez górnej granicy
+
+void stats_count(stat_counter counter, uint64_t n);
+void stats_copied(copy_method method, uint64_t bytes, const struct timespec *start);
+void stats_cycle_begin(void);
+void stats_cycle_end(void);
+void stats_set_file(const char *path);
+void stats_dump(void);
+void stats_cycle_totals(uint64_t counters[STAT_COUNTERS], uint64_t *files, uint64_t *bytes);
+void stats_set_current(const char *path);
+void stats_status(char *buf, size_t size);
+
+#endif
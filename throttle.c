@@ -0,0 +1,162 @@
+#include "throttle.h"
+#include "log.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+// ograniczenie ruchu kubełkiem żetonów: każdy skopiowany bajt (plik) zużywa żeton, żetony przybywają
+// w stałym tempie; wątek, który wyczerpał kubełek, czeka aż dług zostanie spłacony
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#define MAX_WINDOWS 8
+
+typedef struct bucket
+{
+    double rate;   // żetony na sekundę, 0 bez ograniczenia
+    double tokens; // ujemne oznacza dług
+    struct timespec last;
+} bucket;
+
+typedef struct window // przedział czasu doby (w minutach), w którym synchronizacja działa bez ograniczeń
+{
+    int from, to;
+} window;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bucket bytes_bucket, files_bucket;
+static int ioprio = 0; // 0 to domyślny priorytet
+static window windows[MAX_WINDOWS];
+static int window_count = 0;
+static atomic_bool limited = true;     // ograniczenia obowiązują w tej chwili
+static atomic_llong checked = 0;       // sekunda ostatniego sprawdzenia harmonogramu
+
+static void set_rate(bucket *b, uint64_t rate)
+{
+    b->rate = rate;
+    b->tokens = rate; // pierwsza sekunda bez czekania
+    clock_gettime(CLOCK_MONOTONIC, &b->last);
+}
+
+void throttle_set_byte_rate(uint64_t bytes_per_sec)
+{
+    set_rate(&bytes_bucket, bytes_per_sec);
+}
+
+void throttle_set_file_rate(uint64_t files_per_sec)
+{
+    set_rate(&files_bucket, files_per_sec);
+}
+
+int throttle_set_ioprio(const char *spec) // idle, be lub be:poziom (0 najwyższy, 7 najniższy)
+{
+    int level = 4;
+    if (strcmp(spec, "idle") == 0)
+    {
+        ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+        return 0;
+    }
+    if (strcmp(spec, "be") == 0 || (sscanf(spec, "be:%d", &level) == 1 && level >= 0 && level <= 7))
+    {
+        ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | level;
+        return 0;
+    }
+    return -1;
+}
+
+int throttle_set_schedule(const char *spec) // HH:MM-HH:MM[,HH:MM-HH:MM...] czasu lokalnego
+{
+    window_count = 0;
+    while (*spec != '\0')
+    {
+        int h1, m1, h2, m2, len;
+        if (window_count == MAX_WINDOWS || sscanf(spec, "%d:%d-%d:%d%n", &h1, &m1, &h2, &m2, &len) != 4) return -1;
+        if (h1 < 0 || h1 > 24 || h2 < 0 || h2 > 24 || m1 < 0 || m1 > 59 || m2 < 0 || m2 > 59) return -1;
+        windows[window_count].from = h1 * 60 + m1;
+        windows[window_count].to = h2 * 60 + m2;
+        window_count++;
+        spec += len;
+        if (*spec == ',') spec++;
+        else if (*spec != '\0') return -1;
+    }
+    return 0;
+}
+
+static bool in_window(time_t now)
+{
+    struct tm tm;
+    localtime_r(&now, &tm);
+    int minute = tm.tm_hour * 60 + tm.tm_min, i;
+    for (i = 0; i < window_count; i++)
+    {
+        const window *w = &windows[i];
+        if (w->from <= w->to ? (minute >= w->from && minute < w->to) : (minute >= w->from || minute < w->to)) return true; // przedział może przechodzić przez północ
+    }
+    return false;
+}
+
+static bool active(void) // czy ograniczenia obowiązują teraz, harmonogram sprawdzany najwyżej raz na sekundę
+{
+    if (window_count > 0)
+    {
+        time_t now = time(NULL);
+        if (atomic_exchange(&checked, now) != now)
+        {
+            bool value = !in_window(now);
+            if (atomic_exchange(&limited, value) != value) log_printf(LOG_LEVEL_INFO, "%s\n", value ? "Outside the full speed window, throttling synchronization" : "Inside the full speed window, synchronizing at full speed");
+        }
+    }
+    return atomic_load(&limited);
+}
+
+void throttle_begin(void) // na początku synchronizacji: klasa priorytetu wątku, dziedziczona przez tworzone później wątki
+{
+    if (ioprio == 0) return;
+    int value = (active() ? ioprio : 0);
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, value) != 0) log_printf(LOG_LEVEL_WARNING, "Couldn't set the I/O priority\n");
+}
+
+void throttle_idle(void) // wątki pracujące w tle, np. opróżnianie kosza
+{
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0) log_printf(LOG_LEVEL_WARNING, "Couldn't set the I/O priority\n");
+}
+
+bool throttle_limited(void)
+{
+    return (bytes_bucket.rate > 0 || files_bucket.rate > 0) && active();
+}
+
+static void take(bucket *b, double n)
+{
+    if (b->rate <= 0 || !active()) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    pthread_mutex_lock(&lock);
+    b->tokens += ((now.tv_sec - b->last.tv_sec) + (now.tv_nsec - b->last.tv_nsec) / 1e9) * b->rate;
+    if (b->tokens > b->rate) b->tokens = b->rate; // najwyżej sekunda zapasu
+    b->last = now;
+    b->tokens -= n;
+    double wait = (b->tokens < 0 ? -b->tokens / b->rate : 0);
+    pthread_mutex_unlock(&lock);
+    if (wait > 0)
+    {
+        struct timespec ts = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+void throttle_bytes(uint64_t n)
+{
+    take(&bytes_bucket, n);
+}
+
+void throttle_file(void)
+{
+    take(&files_bucket, 1);
+}
@@ -0,0 +1,19 @@
+#ifndef FILESYNC_THROTTLE
+#define FILESYNC_THROTTLE
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define THROTTLE_CHUNK (1024 * 1024) // największa porcja kopiowana bez sprawdzenia limitu
+
+void throttle_set_byte_rate(uint64_t bytes_per_sec);
+void throttle_set_file_rate(uint64_t files_per_sec);
+int throttle_set_ioprio(const char *spec);
+int throttle_set_schedule(const char *spec);
+void throttle_begin(void);
+void throttle_idle(void);
+bool throttle_limited(void);
+void throttle_bytes(uint64_t n);
+void throttle_file(void);
+
+#endif
@@ -0,0 +1,136 @@
+#include "trash.h"
+#include "filesync.h"
+#include "index.h"
+#include "log.h"
+#include "throttle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// usuwany katalog jest tylko przenoszony (rename) do kosza w katalogu stanu na tym samym systemie plików,
+// więc synchronizacja nie czeka na jego zawartość; jeden wątek w tle o najniższym priorytecie
+// wejścia-wyjścia opróżnia kosze, także z pozostałościami po przerwanej pracy demona
+
+typedef struct trash_dir
+{
+    char path[PATH_MAX];
+    bool dirty; // kosz zawiera elementy do usunięcia
+    struct trash_dir *next;
+} trash_dir;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static trash_dir *dirs = NULL;
+static bool started = false, busy = false;
+static atomic_ulong counter = 0;
+
+static void empty_trash(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = (fd != -1 ? fdopendir(fd) : NULL);
+    if (dir == NULL)
+    {
+        if (fd != -1) close(fd);
+        log_printf(LOG_LEVEL_ERROR, "Failed opening the trash (%s)\n", path);
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        if (remove_entry_at(dirfd(dir), ent->d_name, ent->d_type) != 0) log_printf(LOG_LEVEL_ERROR, "Failed emptying the trash (%s/%s)\n", path, ent->d_name);
+    }
+    closedir(dir);
+}
+
+static void *trash_worker(void *arg)
+{
+    (void)arg;
+    throttle_idle();
+    pthread_mutex_lock(&lock);
+    while (1)
+    {
+        trash_dir *t;
+        for (t = dirs; t != NULL && !t->dirty; t = t->next);
+        if (t == NULL)
+        {
+            busy = false;
+            pthread_cond_broadcast(&idle);
+            pthread_cond_wait(&work, &lock);
+            continue;
+        }
+        busy = true;
+        t->dirty = false; // elementy przeniesione w trakcie opróżniania oznaczą kosz ponownie
+        pthread_mutex_unlock(&lock);
+        empty_trash(t->path);
+        pthread_mutex_lock(&lock);
+    }
+    return NULL;
+}
+
+static bool mark_dirty(const char *path) // zgłoś kosz do opróżnienia, przy pierwszym użyciu uruchom wątek
+{
+    pthread_mutex_lock(&lock);
+    if (!started)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, trash_worker, NULL) != 0)
+        {
+            pthread_mutex_unlock(&lock);
+            return false;
+        }
+        pthread_detach(thread);
+        started = true;
+    }
+    trash_dir *t;
+    for (t = dirs; t != NULL && strcmp(t->path, path) != 0; t = t->next);
+    if (t == NULL && (t = calloc(1, sizeof(*t))) != NULL)
+    {
+        snprintf(t->path, sizeof(t->path), "%s", path);
+        t->next = dirs;
+        dirs = t;
+    }
+    if (t != NULL)
+    {
+        t->dirty = true;
+        pthread_cond_signal(&work);
+    }
+    pthread_mutex_unlock(&lock);
+    return t != NULL;
+}
+
+int trash_move(const char *root, const char *path) // przenieś poddrzewo do kosza w katalogu docelowym root, -1 jeśli trzeba usunąć je od razu
+{
+    char trash[PATH_MAX], target[PATH_MAX + 64];
+    snprintf(trash, sizeof(trash), "%s/%s", root, STATE_DIR_NAME);
+    mkdir(trash, 0755);
+    snprintf(trash, sizeof(trash), "%s/%s/%s", root, STATE_DIR_NAME, TRASH_DIR_NAME);
+    if ((mkdir(trash, 0700) != 0 && errno != EEXIST) || !mark_dirty(trash)) return -1; // kosz z poprzedniego uruchomienia też zostanie opróżniony
+    snprintf(target, sizeof(target), "%s/%lld.%d.%lu", trash, (long long)time(NULL), (int)getpid(), atomic_fetch_add(&counter, 1));
+    if (rename(path, target) != 0) return -1; // np. punkt montowania innego systemu plików
+    mark_dirty(trash);
+    return 0;
+}
+
+void trash_wait(void) // przed zakończeniem pojedynczej synchronizacji
+{
+    pthread_mutex_lock(&lock);
+    while (started)
+    {
+        trash_dir *t;
+        for (t = dirs; t != NULL && !t->dirty; t = t->next);
+        if (t == NULL && !busy) break;
+        pthread_cond_wait(&idle, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
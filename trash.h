@@ -0,0 +1,9 @@
+#ifndef FILESYNC_TRASH
+#define FILESYNC_TRASH
+
+#define TRASH_DIR_NAME "trash" // usuwane poddrzewa w katalogu stanu, kasowane w tle
+
+int trash_move(const char *root, const char *path);
+void trash_wait(void);
+
+#endif
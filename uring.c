@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define SLOT_CHUNKS 4 // fragmenty jednego pliku odczytywane i zapisywane równolegle
+#define CHUNK_SIZE (64 * 1024)
+#define SLOT_OP SLOT_CHUNKS // numer operacji dotyczącej całego pliku (otwarcie, zamknięcie)
+#define TO_EOF ((off_t)INT64_MAX) // koniec ostatniego zakresu: czytany do końca pliku, jak przy zwykłym kopiowaniu
+
+typedef enum slot_state
+{
+    ST_OPEN_SRC,
+    ST_OPEN_DST,
+    ST_DATA,
+    ST_CLOSE_SRC,
+    ST_CLOSE_DST
+} slot_state;
+
+typedef struct chunk // zakres pliku kopiowany niezależnie od pozostałych: odczyt, potem zapis
+{
+    char *buf;
+    off_t off, end;      // bieżące położenie i koniec przydzielonego zakresu
+    size_t len, written; // dane w buforze i ich zapisana część
+    bool busy, writing;
+} chunk;
+
+typedef struct slot // jeden kopiowany plik; otwarcie i zamknięcie pojedynczo, dane w kilku fragmentach naraz
+{
+    uring_copy_req *req;
+    slot_state state;
+    int src_fd, dst_fd;
+    off_t next_off; // początek zakresu dla następnego wolnego fragmentu
+    unsigned busy;  // fragmenty z operacją w toku
+    chunk chunks[SLOT_CHUNKS];
+} slot;
+
+struct uring_ctx
+{
+    int fd;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_local_tail, to_submit;
+    slot *slots;
+    unsigned slot_count;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static bool ops_supported(int fd) // sprawdź czy jądro obsługuje wszystkie potrzebne operacje
+{
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (probe == NULL) return false;
+    bool res = false;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+    {
+        int ops[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE };
+        size_t i;
+        res = true;
+        for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+        {
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) res = false;
+        }
+    }
+    free(probe);
+    return res;
+}
+
+uring_ctx *uring_create(unsigned depth)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sys_setup(depth, &p);
+    if (fd < 0) return NULL; // brak io_uring (stare jądro, seccomp, io_uring_disabled)
+    if (!ops_supported(fd))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    uring_ctx *ring = calloc(1, sizeof(*ring));
+    if (ring == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) ring->sq_ptr = NULL;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) ring->cq_ptr = ring->sq_ptr;
+    else if (ring->sq_ptr != NULL)
+    {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) ring->cq_ptr = NULL;
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) ring->sqes = NULL;
+    if (ring->sq_ptr == NULL || ring->cq_ptr == NULL || ring->sqes == NULL)
+    {
+        uring_destroy(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_ptr, *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    // każdy plik ma co najwyżej SLOT_CHUNKS operacji w toku, więc wszystkie mieszczą się w kolejce
+    ring->slot_count = p.sq_entries / SLOT_CHUNKS;
+    ring->slots = calloc(ring->slot_count, sizeof(slot));
+    if (ring->slot_count == 0 || ring->slots == NULL)
+    {
+        uring_destroy(ring);
+        return NULL;
+    }
+    unsigned i, k;
+    for (i = 0; i < ring->slot_count; i++)
+    {
+        for (k = 0; k < SLOT_CHUNKS; k++)
+        {
+            ring->slots[i].chunks[k].buf = malloc(CHUNK_SIZE);
+            if (ring->slots[i].chunks[k].buf == NULL)
+            {
+                uring_destroy(ring);
+                return NULL;
+            }
+        }
+    }
+    return ring;
+}
+
+void uring_destroy(uring_ctx *ring)
+{
+    if (ring == NULL) return;
+    unsigned i, k;
+    if (ring->slots != NULL)
+    {
+        for (i = 0; i < ring->slot_count; i++)
+        {
+            for (k = 0; k < SLOT_CHUNKS; k++) free(ring->slots[i].chunks[k].buf);
+        }
+        free(ring->slots);
+    }
+    if (ring->sqes != NULL) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr != NULL) munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->fd >= 0) close(ring->fd);
+    free(ring);
+}
+
+static struct io_uring_sqe *next_sqe(uring_ctx *ring, uint64_t user_data)
+{
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    ring->to_submit++;
+    return sqe;
+}
+
+static void queue_slot_op(uring_ctx *ring, unsigned i) // otwarcie lub zamknięcie pliku w bieżącym stanie
+{
+    slot *s = &ring->slots[i];
+    struct io_uring_sqe *sqe = next_sqe(ring, (uint64_t)i * (SLOT_CHUNKS + 1) + SLOT_OP);
+    switch (s->state)
+    {
+        case ST_OPEN_SRC:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)s->req->src;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            break;
+        case ST_OPEN_DST:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uintptr_t)s->req->dst;
+            sqe->open_flags = O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC;
+            sqe->len = 0644;
+            break;
+        case ST_CLOSE_SRC:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = s->src_fd;
+            break;
+        case ST_CLOSE_DST:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = s->dst_fd;
+            break;
+        case ST_DATA: // dane przesyłają fragmenty
+            sqe->opcode = IORING_OP_NOP;
+            break;
+    }
+}
+
+static void queue_chunk(uring_ctx *ring, unsigned i, unsigned k) // odczyt lub zapis fragmentu
+{
+    slot *s = &ring->slots[i];
+    chunk *c = &s->chunks[k];
+    struct io_uring_sqe *sqe = next_sqe(ring, (uint64_t)i * (SLOT_CHUNKS + 1) + k);
+    if (c->writing)
+    {
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = s->dst_fd;
+        sqe->addr = (uintptr_t)(c->buf + c->written);
+        sqe->len = c->len - c->written;
+        sqe->off = c->off + c->written;
+    }
+    else
+    {
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = s->src_fd;
+        sqe->addr = (uintptr_t)c->buf;
+        sqe->len = (c->end - c->off < CHUNK_SIZE ? (unsigned)(c->end - c->off) : CHUNK_SIZE);
+        sqe->off = c->off;
+    }
+}
+
+static bool finish_slot(uring_ctx *ring, unsigned i) // zamknij otwarte deskryptory; false, jeśli nie ma czego zamykać
+{
+    slot *s = &ring->slots[i];
+    if (s->state < ST_CLOSE_SRC && s->src_fd >= 0) s->state = ST_CLOSE_SRC;
+    else if (s->state < ST_CLOSE_DST && s->dst_fd >= 0) s->state = ST_CLOSE_DST;
+    else return false;
+    queue_slot_op(ring, i);
+    return true;
+}
+
+static bool start_chunk(uring_ctx *ring, unsigned i, unsigned k) // przydziel fragmentowi następny zakres pliku
+{
+    slot *s = &ring->slots[i];
+    chunk *c = &s->chunks[k];
+    if (s->req->result != 0 || s->next_off >= s->req->size) return false;
+    c->off = s->next_off;
+    c->end = (s->req->size - c->off <= CHUNK_SIZE ? TO_EOF : c->off + CHUNK_SIZE);
+    s->next_off = c->end;
+    c->writing = false;
+    c->busy = true;
+    s->busy++;
+    queue_chunk(ring, i, k);
+    return true;
+}
+
+static bool advance_slot(uring_ctx *ring, unsigned i, int res) // wynik otwarcia lub zamknięcia; false, gdy kopiowanie pliku się zakończyło
+{
+    slot *s = &ring->slots[i];
+    unsigned k;
+    switch (s->state)
+    {
+        case ST_OPEN_SRC:
+            if (res < 0)
+            {
+                s->req->result = -1;
+                return false;
+            }
+            s->src_fd = res;
+            s->state = ST_OPEN_DST;
+            queue_slot_op(ring, i);
+            return true;
+        case ST_OPEN_DST:
+            if (res < 0)
+            {
+                s->req->result = -2;
+                return finish_slot(ring, i);
+            }
+            s->dst_fd = res;
+            s->state = ST_DATA;
+            s->next_off = 0;
+            for (k = 0; k < SLOT_CHUNKS; k++) start_chunk(ring, i, k); // rozmiar znany z wcześniejszego stat, zakresy od razu dla wszystkich fragmentów
+            return (s->busy > 0 ? true : finish_slot(ring, i)); // pusty plik, wystarczy O_TRUNC
+        case ST_DATA:
+            return true;
+        case ST_CLOSE_SRC:
+            s->src_fd = -1;
+            return finish_slot(ring, i);
+        case ST_CLOSE_DST:
+            s->dst_fd = -1;
+            if (res < 0 && s->req->result == 0) s->req->result = -3; // błąd zapisu zgłoszony przy zamknięciu
+            return false;
+    }
+    return false;
+}
+
+static bool advance_chunk(uring_ctx *ring, unsigned i, unsigned k, int res) // wynik odczytu lub zapisu fragmentu; false, gdy kopiowanie pliku się zakończyło
+{
+    slot *s = &ring->slots[i];
+    chunk *c = &s->chunks[k];
+    if (!c->writing)
+    {
+        if (res < 0) s->req->result = -3;
+        else if (res > 0 && s->req->result == 0)
+        {
+            c->len = res;
+            c->written = 0;
+            c->writing = true;
+            queue_chunk(ring, i, k);
+            return true;
+        }
+        // 0 oznacza koniec pliku
+    }
+    else if (res <= 0) s->req->result = -3;
+    else
+    {
+        c->written += res;
+        c->writing = (c->written < c->len); // częściowy zapis, dopisz resztę
+        if (!c->writing) c->off += c->len;
+        if (s->req->result == 0 && (c->writing || c->off < c->end)) // reszta zakresu po krótkim odczycie lub do końca pliku
+        {
+            queue_chunk(ring, i, k);
+            return true;
+        }
+    }
+    c->busy = false;
+    s->busy--;
+    if (start_chunk(ring, i, k) || s->busy > 0) return true;
+    return finish_slot(ring, i); // po błędzie dopiero, gdy pozostałe fragmenty zakończą operacje
+}
+
+void uring_copy_batch(uring_ctx *ring, uring_copy_req *reqs, size_t count) // kopiuj wiele plików naraz, każdy jako openat, równoległe read/write jego zakresów, close
+{
+    size_t next = 0, active = 0;
+    unsigned i, k;
+    for (i = 0; i < ring->slot_count; i++) ring->slots[i].req = NULL;
+
+    while (next < count || active > 0)
+    {
+        for (i = 0; i < ring->slot_count && next < count; i++) // zajmij wolne miejsca kolejnymi plikami
+        {
+            slot *s = &ring->slots[i];
+            if (s->req != NULL) continue;
+            s->req = &reqs[next++];
+            s->req->result = 0;
+            s->state = ST_OPEN_SRC;
+            s->src_fd = s->dst_fd = -1;
+            s->busy = 0;
+            for (k = 0; k < SLOT_CHUNKS; k++) s->chunks[k].busy = false;
+            queue_slot_op(ring, i);
+            active++;
+        }
+
+        __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+        int res = sys_enter(ring->fd, ring->to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (res < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            break;
+        }
+        ring->to_submit -= (unsigned)res < ring->to_submit ? (unsigned)res : ring->to_submit;
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            unsigned index = (unsigned)(cqe->user_data / (SLOT_CHUNKS + 1)), op = (unsigned)(cqe->user_data % (SLOT_CHUNKS + 1));
+            slot *s = &ring->slots[index];
+            if (op == SLOT_OP ? advance_slot(ring, index, cqe->res) : advance_chunk(ring, index, op, cqe->res)) continue;
+            s->req = NULL;
+            active--;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (next < count || active > 0) // io_uring przestał działać, pozostałe pliki skopiuje zwykła ścieżka
+    {
+        for (i = 0; i < ring->slot_count; i++)
+        {
+            slot *s = &ring->slots[i];
+            if (s->req == NULL) continue;
+            // deskryptory bez zamknięcia w toku; zamykany w toku numer mógł już zostać użyty ponownie
+            if (s->src_fd >= 0 && s->state != ST_CLOSE_SRC) close(s->src_fd);
+            if (s->dst_fd >= 0 && s->state != ST_CLOSE_DST) close(s->dst_fd);
+            s->req->result = -4;
+            s->req = NULL;
+            for (k = 0; k < SLOT_CHUNKS; k++) s->chunks[k].buf = NULL; // operacje w toku mogą jeszcze pisać do buforów, więc nie zostaną zwolnione
+        }
+        for (; next < count; next++) reqs[next].result = -4;
+        close(ring->fd); // zamknięcie pierścienia anuluje pozostałe operacje
+        ring->fd = -1;
+    }
+}
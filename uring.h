@@ -0,0 +1,21 @@
+#ifndef FILESYNC_URING
+#define FILESYNC_URING
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct uring_copy_req
+{
+    const char *src, *dst;
+    off_t size;  // rozmiar z wcześniejszego stat wywołującego, dzieli plik na równolegle kopiowane zakresy
+    void *data;  // dane wywołującego
+    int result;  // 0, -1 (źródło), -2 (cel), -3 (zapis), -4 (io_uring zawiódł, użyj zwykłej ścieżki)
+} uring_copy_req;
+
+typedef struct uring_ctx uring_ctx;
+
+uring_ctx *uring_create(unsigned depth);
+void uring_copy_batch(uring_ctx *ring, uring_copy_req *reqs, size_t count); // po wyniku -4 pierścień nadaje się tylko do uring_destroy
+void uring_destroy(uring_ctx *ring);
+
+#endif
@@ -0,0 +1,277 @@
+#include "watch.h"
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+static void make_path(const watcher *w, const char *rel, char *path, size_t size)
+{
+    if (rel[0] == '\0') snprintf(path, size, "%s", w->root);
+    else snprintf(path, size, "%s/%s", w->root, rel);
+}
+
+static void join_rel(const char *rel, const char *name, char *out, size_t size)
+{
+    if (rel[0] == '\0') snprintf(out, size, "%s", name);
+    else snprintf(out, size, "%s/%s", rel, name);
+}
+
+static bool rel_within(const char *parent, const char *rel) // sprawdź czy rel leży w poddrzewie parent (lub jest nim)
+{
+    size_t len = strlen(parent);
+    if (len == 0) return true;
+    return strncmp(parent, rel, len) == 0 && (rel[len] == '\0' || rel[len] == '/');
+}
+
+static watch_entry *find_watch(watcher *w, int wd)
+{
+    size_t i;
+    for (i = 0; i < w->watch_count; i++)
+    {
+        if (w->watches[i].wd == wd) return &w->watches[i];
+    }
+    return NULL;
+}
+
+static void drop_watch(watcher *w, size_t i)
+{
+    free(w->watches[i].rel);
+    w->watches[i] = w->watches[--w->watch_count];
+}
+
+static int add_watch(watcher *w, const char *rel)
+{
+    char path[PATH_MAX];
+    make_path(w, rel, path, sizeof(path));
+    int wd = inotify_add_watch(w->fd, path, WATCH_MASK);
+    if (wd < 0)
+    {
+        if (errno == ENOSPC)
+        {
+            if (!w->rebuild) log_write(LOG_LEVEL_WARNING, "inotify watch limit reached, relying on periodic rescans until watches can be added\n");
+            w->overflow = true;
+            w->rebuild = true; // ponowna próba przy następnej pełnej synchronizacji
+        }
+        return -1;
+    }
+    watch_entry *e = find_watch(w, wd); // ten sam katalog może zostać dodany ponownie
+    if (e != NULL)
+    {
+        free(e->rel);
+        e->rel = strdup(rel);
+        return 0;
+    }
+    if (w->watch_count == w->watch_cap)
+    {
+        size_t cap = w->watch_cap ? w->watch_cap * 2 : 64;
+        watch_entry *n = realloc(w->watches, cap * sizeof(*n));
+        if (n == NULL) return -1;
+        w->watches = n;
+        w->watch_cap = cap;
+    }
+    w->watches[w->watch_count].wd = wd;
+    w->watches[w->watch_count].rel = strdup(rel);
+    w->watch_count++;
+    return 0;
+}
+
+static void add_watch_tree(watcher *w, const char *rel) // obserwuj katalog i wszystkie jego podkatalogi
+{
+    if (add_watch(w, rel) != 0 || !w->recursive) return;
+
+    char path[PATH_MAX];
+    make_path(w, rel, path, sizeof(path));
+    DIR *dir = opendir(path);
+    if (dir == NULL) return;
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (ent->d_type != DT_DIR) continue;
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+        char child[PATH_MAX];
+        join_rel(rel, ent->d_name, child, sizeof(child));
+        add_watch_tree(w, child);
+    }
+    closedir(dir);
+}
+
+static void remove_watch_tree(watcher *w, const char *rel) // przestań obserwować przeniesione poddrzewo
+{
+    size_t i = 0;
+    while (i < w->watch_count)
+    {
+        if (rel_within(rel, w->watches[i].rel))
+        {
+            inotify_rm_watch(w->fd, w->watches[i].wd);
+            drop_watch(w, i);
+        }
+        else i++;
+    }
+}
+
+static void mark_dirty(watcher *w, const char *rel, bool recursive)
+{
+    size_t i;
+    for (i = 0; i < w->dirty_count; i++)
+    {
+        dirty_entry *d = &w->dirty[i];
+        if (d->recursive && rel_within(d->rel, rel)) return; // przodek i tak zostanie przejrzany w całości
+        if (strcmp(d->rel, rel) == 0)
+        {
+            d->recursive = d->recursive || recursive;
+            return;
+        }
+    }
+    if (recursive) // usuń wpisy pokryte przez nowe poddrzewo
+    {
+        i = 0;
+        while (i < w->dirty_count)
+        {
+            if (rel_within(rel, w->dirty[i].rel))
+            {
+                free(w->dirty[i].rel);
+                w->dirty[i] = w->dirty[--w->dirty_count];
+            }
+            else i++;
+        }
+    }
+    if (w->dirty_count == w->dirty_cap)
+    {
+        size_t cap = w->dirty_cap ? w->dirty_cap * 2 : 64;
+        dirty_entry *n = realloc(w->dirty, cap * sizeof(*n));
+        if (n == NULL)
+        {
+            w->overflow = true;
+            return;
+        }
+        w->dirty = n;
+        w->dirty_cap = cap;
+    }
+    w->dirty[w->dirty_count].rel = strdup(rel);
+    w->dirty[w->dirty_count].recursive = recursive;
+    w->dirty_count++;
+}
+
+static void handle_event(watcher *w, const struct inotify_event *ev)
+{
+    if (ev->mask & IN_Q_OVERFLOW) // kolejka jądra przepełniona, zdarzenia utracone, w tym o nowych katalogach do obserwowania
+    {
+        w->overflow = true;
+        w->rebuild = true;
+        return;
+    }
+    watch_entry *e = find_watch(w, ev->wd);
+    if (e == NULL) return;
+    if (ev->mask & IN_IGNORED)
+    {
+        drop_watch(w, e - w->watches);
+        return;
+    }
+    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+    {
+        if (e->rel[0] == '\0') w->overflow = w->rebuild = true; // zniknął katalog główny
+        return;
+    }
+    if (ev->len == 0) return;
+
+    if (ev->mask & IN_ISDIR)
+    {
+        if (!w->recursive) return; // w trybie nierekurencyjnym podkatalogi są pomijane
+        char child[PATH_MAX];
+        join_rel(e->rel, ev->name, child, sizeof(child));
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            add_watch_tree(w, child); // obserwuj przed synchronizacją, by nie zgubić zmian
+            mark_dirty(w, child, true);
+        }
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            if (ev->mask & IN_MOVED_FROM) remove_watch_tree(w, child);
+            mark_dirty(w, child, true);
+        }
+        return;
+    }
+    mark_dirty(w, e->rel, false);
+}
+
+int watcher_init(watcher *w, const char *root, bool recursive)
+{
+    memset(w, 0, sizeof(*w));
+    snprintf(w->root, sizeof(w->root), "%s", root);
+    w->recursive = recursive;
+    w->wake_fd = -1;
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) return -1;
+    add_watch_tree(w, "");
+    if (w->watch_count == 0)
+    {
+        watcher_close(w);
+        return -1;
+    }
+    w->overflow = false; // pełna synchronizacja i tak nastąpi po inicjalizacji
+    return 0;
+}
+
+int watcher_wait(watcher *w, int timeout_ms) // czekaj na zdarzenia i dopisz zmienione katalogi do kolejki; 2 oznacza przebudzenie przez wake_fd
+{
+    struct pollfd pfd[2] = { { .fd = w->fd, .events = POLLIN }, { .fd = w->wake_fd, .events = POLLIN } };
+    int res = poll(pfd, (w->wake_fd != -1 ? 2 : 1), timeout_ms);
+    if (res <= 0) return res;
+    if (!(pfd[0].revents & POLLIN)) return 2;
+
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(w->fd, buf, sizeof(buf))) > 0)
+    {
+        char *p = buf;
+        while (p < buf + len)
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            handle_event(w, ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return 1;
+}
+
+int watcher_rebuild(watcher *w) // obserwuj drzewo od nowa; gdy się nie uda, rebuild zostaje ustawione do następnej próby
+{
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "%s", w->root);
+    int wake_fd = w->wake_fd;
+    watcher_close(w);
+    int res = watcher_init(w, root, w->recursive);
+    w->wake_fd = wake_fd;
+    if (res != 0) w->rebuild = true; // np. katalog główny jeszcze nie istnieje
+    return res;
+}
+
+void watcher_clear(watcher *w) // wyczyść kolejkę po jej przetworzeniu
+{
+    size_t i;
+    for (i = 0; i < w->dirty_count; i++) free(w->dirty[i].rel);
+    w->dirty_count = 0;
+    w->overflow = false;
+}
+
+void watcher_close(watcher *w)
+{
+    size_t i;
+    watcher_clear(w);
+    for (i = 0; i < w->watch_count; i++) free(w->watches[i].rel);
+    free(w->watches);
+    free(w->dirty);
+    if (w->fd >= 0) close(w->fd);
+    w->watches = NULL;
+    w->dirty = NULL;
+    w->watch_count = w->watch_cap = w->dirty_cap = 0;
+    w->fd = -1;
+}
@@ -0,0 +1,40 @@
+#ifndef FILESYNC_WATCH
+#define FILESYNC_WATCH
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+
+typedef struct watch_entry
+{
+    int wd;
+    char *rel; // ścieżka obserwowanego katalogu względem korzenia ("" dla korzenia)
+} watch_entry;
+
+typedef struct dirty_entry
+{
+    char *rel;
+    bool recursive; // czy poddrzewo wymaga pełnego porównania
+} dirty_entry;
+
+typedef struct watcher
+{
+    int fd;
+    char root[PATH_MAX];
+    bool recursive;
+    bool overflow; // utracono zdarzenia, potrzebne pełne skanowanie
+    bool rebuild;  // zestaw obserwowanych katalogów jest niepełny, odbudować przed pełnym skanowaniem
+    int wake_fd;   // -1 lub deskryptor, którego gotowość przerywa oczekiwanie (żądania z gniazda sterującego)
+    watch_entry *watches;
+    size_t watch_count, watch_cap;
+    dirty_entry *dirty;
+    size_t dirty_count, dirty_cap;
+} watcher;
+
+int watcher_init(watcher *w, const char *root, bool recursive);
+int watcher_wait(watcher *w, int timeout_ms);
+int watcher_rebuild(watcher *w);
+void watcher_clear(watcher *w);
+void watcher_close(watcher *w);
+
+#endif